@@ -0,0 +1,491 @@
+// Standalone benchmark for EntityManager hot paths.
+// Usage: Plugin.Core.EntityManager.Benchmark [--entities=1000,100000,1000000]
+//        [--components=position,velocity,health,tag,tagranges]
+//        [--materialize=10000] [--iterations=3] [--output=results.json]
+// Results are written as one JSON object per line.
+// Exit code is non-zero if entities replicated in-process don't match the source entities.
+
+#include "../EntityManager.h"
+#include "../EntityReference.h"
+#include "../EntityReplication.h"
+#include "../TagEntityComponent.h"
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/IO/ArchiveSerialization.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include <EASTL/map.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+using namespace Urho3D;
+
+namespace
+{
+
+struct BenchmarkPosition
+{
+    static constexpr unsigned Version = 1;
+    Vector3 value_;
+
+    void SerializeInBlock(Archive& archive, unsigned version) { SerializeValue(archive, "value", value_); }
+    bool RenderInspector() { return false; }
+};
+
+struct BenchmarkVelocity
+{
+    static constexpr unsigned Version = 1;
+    Vector3 value_;
+
+    void SerializeInBlock(Archive& archive, unsigned version) { SerializeValue(archive, "value", value_); }
+    bool RenderInspector() { return false; }
+};
+
+struct BenchmarkHealth
+{
+    static constexpr unsigned Version = 1;
+    int current_{};
+    int max_{};
+
+    void SerializeInBlock(Archive& archive, unsigned version)
+    {
+        SerializeValue(archive, "current", current_);
+        SerializeValue(archive, "max", max_);
+    }
+    bool RenderInspector() { return false; }
+};
+
+struct BenchmarkTag
+{
+    static constexpr unsigned Version = 1;
+    void SerializeInBlock(Archive& archive, unsigned version) {}
+    bool RenderInspector() { return false; }
+};
+
+/// Same as BenchmarkTag, but registered with TagEntityComponentFactory that serializes tags as ranges.
+struct BenchmarkRangesTag
+{
+    static constexpr unsigned Version = 1;
+    void SerializeInBlock(Archive& archive, unsigned version) {}
+    bool RenderInspector() { return false; }
+};
+
+struct BenchmarkSettings
+{
+    ea::vector<unsigned> entityCounts_{1000, 100000, 1000000};
+    StringVector components_{"position", "velocity", "health", "tag", "tagranges"};
+    unsigned maxMaterialized_{10000};
+    unsigned iterations_{3};
+    ea::string outputFile_;
+};
+
+/// Accumulated timings of single benchmark case.
+struct BenchmarkResult
+{
+    unsigned numOperations_{};
+    double bestNs_{};
+    double totalNs_{};
+    unsigned numSamples_{};
+    unsigned long long numBytes_{};
+
+    void AddSample(double durationNs)
+    {
+        bestNs_ = numSamples_ == 0 ? durationNs : ea::min(bestNs_, durationNs);
+        totalNs_ += durationNs;
+        ++numSamples_;
+    }
+};
+
+using Clock = std::chrono::steady_clock;
+
+template <class Callback> double MeasureNs(const Callback& callback)
+{
+    const auto begin = Clock::now();
+    callback();
+    const auto end = Clock::now();
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+}
+
+bool HasComponent(const BenchmarkSettings& settings, const char* name)
+{
+    return ea::find(settings.components_.begin(), settings.components_.end(), name) != settings.components_.end();
+}
+
+ea::vector<unsigned> ParseUnsignedList(const char* value)
+{
+    ea::vector<unsigned> result;
+    for (const ea::string& item : ea::string(value).split(','))
+        result.push_back(ToUInt(item));
+    return result;
+}
+
+BenchmarkSettings ParseSettings(int argc, char** argv)
+{
+    BenchmarkSettings settings;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const auto matchOption = [&](const char* prefix) -> const char*
+        { return strncmp(arg, prefix, strlen(prefix)) == 0 ? arg + strlen(prefix) : nullptr; };
+
+        if (const char* value = matchOption("--entities="))
+            settings.entityCounts_ = ParseUnsignedList(value);
+        else if (const char* value = matchOption("--components="))
+            settings.components_ = ea::string(value).split(',');
+        else if (const char* value = matchOption("--materialize="))
+            settings.maxMaterialized_ = ToUInt(value);
+        else if (const char* value = matchOption("--iterations="))
+            settings.iterations_ = ea::max(1u, ToUInt(value));
+        else if (const char* value = matchOption("--output="))
+            settings.outputFile_ = value;
+        else
+            fprintf(stderr, "Unknown argument '%s'\n", arg);
+    }
+    return settings;
+}
+
+void RegisterBenchmarkComponents(EntityManager* manager, const BenchmarkSettings& settings)
+{
+    if (HasComponent(settings, "position"))
+        manager->AddComponentType<BenchmarkPosition>("BenchmarkPosition");
+    if (HasComponent(settings, "velocity"))
+        manager->AddComponentType<BenchmarkVelocity>("BenchmarkVelocity");
+    if (HasComponent(settings, "health"))
+        manager->AddComponentType<BenchmarkHealth>("BenchmarkHealth");
+    if (HasComponent(settings, "tag"))
+        manager->AddComponentType<BenchmarkTag>("BenchmarkTag");
+    if (HasComponent(settings, "tagranges"))
+        manager->AddTagComponentType<BenchmarkRangesTag>("BenchmarkRangesTag");
+}
+
+void PopulateRegistry(EntityManager* manager, const BenchmarkSettings& settings, unsigned numEntities)
+{
+    entt::registry& registry = manager->Registry();
+
+    const bool hasPosition = HasComponent(settings, "position");
+    const bool hasVelocity = HasComponent(settings, "velocity");
+    const bool hasHealth = HasComponent(settings, "health");
+    const bool hasTag = HasComponent(settings, "tag");
+    const bool hasRangesTag = HasComponent(settings, "tagranges");
+
+    for (unsigned i = 0; i < numEntities; ++i)
+    {
+        const entt::entity entity = registry.create();
+        const auto value = static_cast<float>(i);
+        if (hasPosition)
+            registry.emplace<BenchmarkPosition>(entity, Vector3{value, value * 0.5f, -value});
+        if (hasVelocity && i % 2 == 0)
+            registry.emplace<BenchmarkVelocity>(entity, Vector3{1.0f, 0.0f, 0.0f});
+        if (hasHealth)
+            registry.emplace<BenchmarkHealth>(entity, static_cast<int>(i % 100), 100);
+        if (hasTag && i % 4 == 0)
+            registry.emplace<BenchmarkTag>(entity);
+        if (hasRangesTag && i % 4 == 0)
+            registry.emplace<BenchmarkRangesTag>(entity);
+    }
+}
+
+/// Add tag to untagged entities and remove it from tagged ones, twice so that the state is restored.
+template <class T> void ToggleTags(entt::registry& registry, const ea::vector<entt::entity>& entities)
+{
+    for (unsigned pass = 0; pass < 2; ++pass)
+    {
+        for (const entt::entity entity : entities)
+        {
+            if (registry.all_of<T>(entity))
+                registry.remove<T>(entity);
+            else
+                registry.emplace<T>(entity);
+        }
+    }
+}
+
+/// Return memory used by packed and sparse arrays of the storage.
+template <class T> unsigned long long GetStorageMemory(entt::registry& registry)
+{
+    const auto& storage = registry.storage<T>();
+    return (storage.capacity() + storage.extent()) * sizeof(entt::entity);
+}
+
+/// Replicate all entities to another manager in the same process and compare encoded entities.
+/// Return number of entities that are missing or different on the receiving side.
+unsigned RunReplicationLoopback(Context* context, EntityManager* manager, const BenchmarkSettings& settings,
+    ea::map<ea::string, BenchmarkResult>& results)
+{
+    // Large budget keeps the number of ticks small, so encoding dominates over prioritization.
+    static const unsigned maxBytesPerTick = 16 * 1024 * 1024;
+
+    auto remoteScene = MakeShared<Scene>(context);
+    auto remoteManager = remoteScene->CreateComponent<EntityManager>();
+    remoteManager->ApplyAttributes();
+    RegisterBenchmarkComponents(remoteManager, settings);
+
+    const auto numEntities = static_cast<unsigned>(manager->GetEntities().size());
+    EntityReplicationSender sender{manager};
+    EntityReplicationReceiver receiver{remoteManager};
+    receiver.SetMaterializeEntities(numEntities <= settings.maxMaterialized_);
+
+    VectorBuffer message;
+    unsigned numTicks = 0;
+
+    BenchmarkResult& result = results["ReplicationLoopback"];
+    result.numOperations_ = numEntities;
+    result.numBytes_ = 0;
+    result.AddSample(MeasureNs(
+        [&]
+    {
+        // Every tick sends at least one entity, so the number of ticks is bounded.
+        while (sender.GetNumReplicatedEntities() < numEntities && numTicks <= numEntities)
+        {
+            message.Clear();
+            sender.WriteTick(message, maxBytesPerTick);
+            result.numBytes_ += message.GetSize();
+            ++numTicks;
+
+            MemoryBuffer src{message.GetBuffer()};
+            if (!receiver.ReadTick(src))
+                break;
+        }
+    }));
+
+    unsigned numMismatches = 0;
+    for (const entt::entity entity : manager->GetEntities())
+    {
+        const entt::entity remoteEntity = receiver.RemoteToLocal(entity);
+        if (remoteEntity == entt::null || manager->EncodeEntity(entity) != remoteManager->EncodeEntity(remoteEntity))
+            ++numMismatches;
+    }
+
+    if (numMismatches != 0)
+        fprintf(stderr, "Replication loopback: %u of %u entities mismatched after %u ticks\n", numMismatches,
+            numEntities, numTicks);
+    return numMismatches;
+}
+
+bool RunBenchmarks(Context* context, const BenchmarkSettings& settings, unsigned numEntities,
+    ea::map<ea::string, BenchmarkResult>& results)
+{
+    auto scene = MakeShared<Scene>(context);
+    auto manager = scene->CreateComponent<EntityManager>();
+    manager->ApplyAttributes();
+    RegisterBenchmarkComponents(manager, settings);
+
+    results["PopulateRegistry"].numOperations_ = numEntities;
+    results["PopulateRegistry"].AddSample(MeasureNs([&] { PopulateRegistry(manager, settings, numEntities); }));
+
+    const ea::vector<entt::entity> entities(manager->GetEntities().begin(), manager->GetEntities().end());
+    const unsigned numMaterialized = ea::min(numEntities, settings.maxMaterialized_);
+
+    ea::vector<ByteVector> encodedEntities(entities.size());
+    ea::vector<Node*> nodes(numMaterialized);
+    ByteVector registryData;
+    volatile unsigned sink = 0;
+
+    for (unsigned iteration = 0; iteration < settings.iterations_; ++iteration)
+    {
+        {
+            BenchmarkResult& result = results["EncodeEntity"];
+            result.numOperations_ = entities.size();
+            result.AddSample(MeasureNs(
+                [&]
+            {
+                for (unsigned i = 0; i < entities.size(); ++i)
+                    encodedEntities[i] = manager->EncodeEntity(entities[i]);
+            }));
+
+            result.numBytes_ = 0;
+            for (const ByteVector& data : encodedEntities)
+                result.numBytes_ += data.size();
+        }
+
+        {
+            const QuantizationHints hints{{"BenchmarkPosition", {{"value", {-1000000.0f, 1000000.0f, 24}}}}};
+            ByteVector data;
+
+            BenchmarkResult& result = results["EncodeEntity.BitPacked"];
+            result.numOperations_ = entities.size();
+            result.numBytes_ = 0;
+            result.AddSample(MeasureNs(
+                [&]
+            {
+                for (const entt::entity entity : entities)
+                {
+                    data = manager->EncodeEntity(manager->Registry(), entity, hints);
+                    result.numBytes_ += data.size();
+                }
+            }));
+        }
+
+        {
+            BenchmarkResult& result = results["DecodeEntity"];
+            result.numOperations_ = entities.size();
+            result.AddSample(MeasureNs(
+                [&]
+            {
+                for (unsigned i = 0; i < entities.size(); ++i)
+                    manager->DecodeEntity(entities[i], encodedEntities[i]);
+            }));
+        }
+
+        {
+            BenchmarkResult& result = results["MaterializeEntity"];
+            result.numOperations_ = numMaterialized;
+            result.AddSample(MeasureNs(
+                [&]
+            {
+                for (unsigned i = 0; i < numMaterialized; ++i)
+                    nodes[i] = manager->MaterializeEntity(entities[i])->GetNode();
+            }));
+        }
+
+        {
+            BenchmarkResult& result = results["EntityToReference"];
+            result.numOperations_ = entities.size();
+            result.AddSample(MeasureNs(
+                [&]
+            {
+                for (const entt::entity entity : entities)
+                    sink = sink + (manager->EntityToReference(entity) != nullptr);
+            }));
+        }
+
+        {
+            BenchmarkResult& result = results["NodeToEntity"];
+            result.numOperations_ = numMaterialized;
+            result.AddSample(MeasureNs(
+                [&]
+            {
+                for (Node* node : nodes)
+                    sink = sink + EntityManager::GetEntityIndex(manager->NodeToEntity(node));
+            }));
+        }
+
+        {
+            for (unsigned i = 0; i < numMaterialized; ++i)
+                manager->QueueDecodeEntity(manager->EntityToReference(entities[i]), encodedEntities[i]);
+
+            BenchmarkResult& result = results["Synchronize"];
+            result.numOperations_ = numMaterialized;
+            result.AddSample(MeasureNs([&] { manager->Synchronize(); }));
+        }
+
+        {
+            BenchmarkResult& result = results["DematerializeEntity"];
+            result.numOperations_ = numMaterialized;
+            result.AddSample(MeasureNs(
+                [&]
+            {
+                for (unsigned i = 0; i < numMaterialized; ++i)
+                    manager->DematerializeEntity(entities[i]);
+            }));
+        }
+
+        {
+            ea::vector<entt::entity> clones;
+
+            BenchmarkResult& result = results["CloneEntity"];
+            result.numOperations_ = numMaterialized;
+            result.AddSample(MeasureNs([&] { clones = manager->CloneEntity(entities.back(), numMaterialized); }));
+
+            BenchmarkResult& destroyResult = results["DestroyQueuedEntities"];
+            destroyResult.numOperations_ = clones.size();
+            destroyResult.AddSample(MeasureNs(
+                [&]
+            {
+                for (const entt::entity clone : clones)
+                    manager->QueueDestroyEntity(clone);
+                manager->DestroyQueuedEntities();
+            }));
+        }
+
+        if (HasComponent(settings, "tag"))
+        {
+            BenchmarkResult& result = results["ToggleTag"];
+            result.numOperations_ = 2 * entities.size();
+            result.AddSample(MeasureNs([&] { ToggleTags<BenchmarkTag>(manager->Registry(), entities); }));
+            result.numBytes_ = GetStorageMemory<BenchmarkTag>(manager->Registry());
+        }
+
+        {
+            BenchmarkResult& result = results["SerializeRegistry.Save"];
+            result.numOperations_ = numEntities;
+            result.AddSample(MeasureNs([&] { registryData = manager->GetDataAttr(); }));
+            result.numBytes_ = registryData.size();
+        }
+    }
+
+    const bool replicationValid = RunReplicationLoopback(context, manager, settings, results) == 0;
+
+    // Loading marks the registry dirty, so it goes last to avoid materializing everything on the next Synchronize.
+    for (unsigned iteration = 0; iteration < settings.iterations_; ++iteration)
+    {
+        BenchmarkResult& result = results["SerializeRegistry.Load"];
+        result.numOperations_ = numEntities;
+        result.numBytes_ = registryData.size();
+        result.AddSample(MeasureNs([&] { manager->SetDataAttr(registryData); }));
+    }
+
+    return replicationValid;
+}
+
+void WriteResults(FILE* output, const BenchmarkSettings& settings, unsigned numEntities,
+    const ea::map<ea::string, BenchmarkResult>& results)
+{
+    ea::string components;
+    for (const ea::string& component : settings.components_)
+        components += components.empty() ? component : "+" + component;
+
+    for (const auto& [name, result] : results)
+    {
+        const double numOperations = ea::max(1u, result.numOperations_);
+        fprintf(output,
+            "{\"benchmark\": \"%s\", \"entities\": %u, \"components\": \"%s\", \"operations\": %u, "
+            "\"samples\": %u, \"best_ns_per_op\": %.2f, \"mean_ns_per_op\": %.2f, \"best_total_ms\": %.3f, "
+            "\"bytes\": %llu}\n",
+            name.c_str(), numEntities, components.c_str(), result.numOperations_, result.numSamples_,
+            result.bestNs_ / numOperations, result.totalNs_ / result.numSamples_ / numOperations,
+            result.bestNs_ / 1000000.0, result.numBytes_);
+    }
+    fflush(output);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const BenchmarkSettings settings = ParseSettings(argc, argv);
+
+    auto context = MakeShared<Context>();
+    RegisterSceneLibrary(context);
+    context->RegisterFactory<EntityManager>();
+    EntityManager::RegisterObject(context);
+    EntityReference::RegisterObject(context);
+
+    FILE* output = stdout;
+    if (!settings.outputFile_.empty())
+    {
+        output = fopen(settings.outputFile_.c_str(), "w");
+        if (!output)
+        {
+            fprintf(stderr, "Cannot open output file '%s'\n", settings.outputFile_.c_str());
+            return 1;
+        }
+    }
+
+    bool succeeded = true;
+    for (const unsigned numEntities : settings.entityCounts_)
+    {
+        ea::map<ea::string, BenchmarkResult> results;
+        if (!RunBenchmarks(context, settings, numEntities, results))
+            succeeded = false;
+        WriteResults(output, settings, numEntities, results);
+    }
+
+    if (output != stdout)
+        fclose(output);
+    return succeeded ? 0 : 1;
+}
@@ -0,0 +1,519 @@
+#include "BitPackedArchive.h"
+
+#include <Urho3D/Math/MathDefs.h>
+
+#include <EASTL/functional.h>
+
+#include <cstring>
+
+namespace Urho3D
+{
+
+namespace
+{
+
+/// Integers are stored as groups of 4 bits with 1 continuation bit.
+const unsigned variableGroupBits = 4;
+const unsigned variableGroupMask = (1u << variableGroupBits) - 1;
+
+unsigned long long ZigZagEncode(long long value)
+{
+    return (static_cast<unsigned long long>(value) << 1) ^ static_cast<unsigned long long>(value >> 63);
+}
+
+long long ZigZagDecode(unsigned long long value)
+{
+    return static_cast<long long>(value >> 1) ^ -static_cast<long long>(value & 1);
+}
+
+} // namespace
+
+BitPackedArchiveBase::BitPackedArchiveBase(Context* context, const QuantizationHints* hints)
+    : context_(context)
+    , hints_(hints)
+{
+    if (hints_)
+    {
+        const auto iter = hints_->find(EMPTY_STRING);
+        if (iter != hints_->end())
+            globalHints_ = &iter->second;
+    }
+}
+
+void BitPackedArchiveBase::SetHintScope(const ea::string& scope)
+{
+    scopeHints_ = nullptr;
+    if (hints_)
+    {
+        const auto iter = hints_->find(scope);
+        if (iter != hints_->end())
+            scopeHints_ = &iter->second;
+    }
+}
+
+const QuantizationHint* BitPackedArchiveBase::FindHint(const char* name) const
+{
+    if (!scopeHints_ && !globalHints_)
+        return nullptr;
+
+    // Look up by C string to avoid string construction for each serialized field.
+    const ea::hash<const char*> hash;
+    const ea::equal_to_2<ea::string, const char*> equal;
+    if (scopeHints_)
+    {
+        const auto iter = scopeHints_->find_as(name, hash, equal);
+        if (iter != scopeHints_->end())
+            return &iter->second;
+    }
+    if (globalHints_)
+    {
+        const auto iter = globalHints_->find_as(name, hash, equal);
+        if (iter != globalHints_->end())
+            return &iter->second;
+    }
+    return nullptr;
+}
+
+unsigned BitPackedArchiveBase::GetMaxQuantizedValue(const QuantizationHint& hint)
+{
+    return hint.bits_ >= 32 ? M_MAX_UNSIGNED : (1u << hint.bits_) - 1;
+}
+
+unsigned BitPackedArchiveBase::QuantizeValue(double value, const QuantizationHint& hint)
+{
+    const double range = static_cast<double>(hint.max_) - hint.min_;
+    const double normalized = range > 0.0 ? Clamp((value - hint.min_) / range, 0.0, 1.0) : 0.0;
+    return static_cast<unsigned>(normalized * GetMaxQuantizedValue(hint) + 0.5);
+}
+
+double BitPackedArchiveBase::DequantizeValue(unsigned value, const QuantizationHint& hint)
+{
+    const double normalized = static_cast<double>(value) / GetMaxQuantizedValue(hint);
+    return hint.min_ + normalized * (static_cast<double>(hint.max_) - hint.min_);
+}
+
+BitPackedOutputArchive::BitPackedOutputArchive(Context* context, const QuantizationHints* hints)
+    : BitPackedArchiveBase(context, hints)
+{
+}
+
+const ByteVector& BitPackedOutputArchive::GetData()
+{
+    FlushBits();
+    return data_;
+}
+
+void BitPackedOutputArchive::Clear()
+{
+    data_.clear();
+    pendingBits_ = 0;
+    numPendingBits_ = 0;
+    sizedBlockOpen_ = false;
+}
+
+void BitPackedOutputArchive::BeginSizedBlock()
+{
+    URHO3D_ASSERT(!sizedBlockOpen_);
+    sizedBlockOpen_ = true;
+
+    // Block content is written separately because its size is not known in advance.
+    ea::swap(data_, outerData_);
+    data_.clear();
+    outerPendingBits_ = pendingBits_;
+    outerNumPendingBits_ = numPendingBits_;
+    pendingBits_ = 0;
+    numPendingBits_ = 0;
+}
+
+void BitPackedOutputArchive::EndSizedBlock()
+{
+    URHO3D_ASSERT(sizedBlockOpen_);
+    sizedBlockOpen_ = false;
+
+    const auto numBlockBits = static_cast<unsigned long long>(data_.size()) * 8 + numPendingBits_;
+    FlushBits();
+
+    ea::swap(data_, outerData_);
+    pendingBits_ = outerPendingBits_;
+    numPendingBits_ = outerNumPendingBits_;
+
+    WriteVariableBits(numBlockBits);
+    const auto numWholeBytes = static_cast<unsigned>(numBlockBits / 8);
+    for (unsigned i = 0; i < numWholeBytes; ++i)
+        WriteBits(outerData_[i], 8);
+    if (const auto numTailBits = static_cast<unsigned>(numBlockBits % 8))
+        WriteBits(outerData_[numWholeBytes], numTailBits);
+}
+
+void BitPackedOutputArchive::WriteBits(unsigned value, unsigned numBits)
+{
+    URHO3D_ASSERT(numBits <= 32);
+    if (numBits < 32)
+        value &= (1u << numBits) - 1;
+
+    pendingBits_ |= static_cast<unsigned long long>(value) << numPendingBits_;
+    numPendingBits_ += numBits;
+
+    while (numPendingBits_ >= 8)
+    {
+        data_.push_back(static_cast<unsigned char>(pendingBits_ & 0xff));
+        pendingBits_ >>= 8;
+        numPendingBits_ -= 8;
+    }
+}
+
+void BitPackedOutputArchive::WriteVariableBits(unsigned long long value)
+{
+    do
+    {
+        const auto group = static_cast<unsigned>(value & variableGroupMask);
+        value >>= variableGroupBits;
+        WriteBits(group | (value != 0 ? 1u << variableGroupBits : 0u), variableGroupBits + 1);
+    } while (value != 0);
+}
+
+void BitPackedOutputArchive::WriteSigned(const char* name, long long value)
+{
+    if (const QuantizationHint* hint = FindHint(name))
+    {
+        const auto minValue = static_cast<long long>(hint->min_);
+        const auto maxValue = static_cast<long long>(hint->max_);
+        const auto offset = static_cast<unsigned long long>(Clamp(value, minValue, maxValue) - minValue);
+        WriteBits(static_cast<unsigned>(ea::min<unsigned long long>(offset, GetMaxQuantizedValue(*hint))), hint->bits_);
+    }
+    else
+        WriteVariableBits(ZigZagEncode(value));
+}
+
+void BitPackedOutputArchive::WriteUnsigned(const char* name, unsigned long long value)
+{
+    if (const QuantizationHint* hint = FindHint(name))
+    {
+        const auto minValue = static_cast<unsigned long long>(ea::max(0.0f, hint->min_));
+        const auto maxValue = static_cast<unsigned long long>(ea::max(0.0f, hint->max_));
+        const unsigned long long offset = Clamp(value, minValue, maxValue) - minValue;
+        WriteBits(static_cast<unsigned>(ea::min<unsigned long long>(offset, GetMaxQuantizedValue(*hint))), hint->bits_);
+    }
+    else
+        WriteVariableBits(value);
+}
+
+void BitPackedOutputArchive::FlushBits()
+{
+    if (numPendingBits_ > 0)
+    {
+        data_.push_back(static_cast<unsigned char>(pendingBits_ & 0xff));
+        pendingBits_ = 0;
+        numPendingBits_ = 0;
+    }
+}
+
+void BitPackedOutputArchive::BeginBlock(const char* name, unsigned& sizeHint, bool safe, ArchiveBlockType type)
+{
+    if (type == ArchiveBlockType::Array || type == ArchiveBlockType::Map)
+        WriteVariableBits(sizeHint);
+}
+
+void BitPackedOutputArchive::Serialize(const char* name, bool& value)
+{
+    WriteBits(value ? 1 : 0, 1);
+}
+
+void BitPackedOutputArchive::Serialize(const char* name, signed char& value)
+{
+    WriteSigned(name, value);
+}
+
+void BitPackedOutputArchive::Serialize(const char* name, unsigned char& value)
+{
+    WriteUnsigned(name, value);
+}
+
+void BitPackedOutputArchive::Serialize(const char* name, short& value)
+{
+    WriteSigned(name, value);
+}
+
+void BitPackedOutputArchive::Serialize(const char* name, unsigned short& value)
+{
+    WriteUnsigned(name, value);
+}
+
+void BitPackedOutputArchive::Serialize(const char* name, int& value)
+{
+    WriteSigned(name, value);
+}
+
+void BitPackedOutputArchive::Serialize(const char* name, unsigned int& value)
+{
+    WriteUnsigned(name, value);
+}
+
+void BitPackedOutputArchive::Serialize(const char* name, long long& value)
+{
+    WriteSigned(name, value);
+}
+
+void BitPackedOutputArchive::Serialize(const char* name, unsigned long long& value)
+{
+    WriteUnsigned(name, value);
+}
+
+void BitPackedOutputArchive::Serialize(const char* name, float& value)
+{
+    if (const QuantizationHint* hint = FindHint(name))
+    {
+        WriteBits(QuantizeValue(value, *hint), hint->bits_);
+    }
+    else
+    {
+        unsigned bits{};
+        memcpy(&bits, &value, sizeof(bits));
+        WriteBits(bits, 32);
+    }
+}
+
+void BitPackedOutputArchive::Serialize(const char* name, double& value)
+{
+    if (const QuantizationHint* hint = FindHint(name))
+    {
+        WriteBits(QuantizeValue(value, *hint), hint->bits_);
+        return;
+    }
+
+    unsigned long long bits{};
+    memcpy(&bits, &value, sizeof(bits));
+    WriteBits(static_cast<unsigned>(bits), 32);
+    WriteBits(static_cast<unsigned>(bits >> 32), 32);
+}
+
+void BitPackedOutputArchive::Serialize(const char* name, ea::string& value)
+{
+    WriteVariableBits(value.size());
+    for (const char ch : value)
+        WriteBits(static_cast<unsigned char>(ch), 8);
+}
+
+void BitPackedOutputArchive::SerializeBytes(const char* name, void* bytes, unsigned size)
+{
+    // Vectors and other float tuples are serialized as bytes, quantize them as arrays of floats.
+    const QuantizationHint* hint = FindHint(name);
+    if (hint && size % sizeof(float) == 0)
+    {
+        const auto floats = static_cast<const float*>(bytes);
+        for (unsigned i = 0; i < size / sizeof(float); ++i)
+            WriteBits(QuantizeValue(floats[i], *hint), hint->bits_);
+    }
+    else
+    {
+        const auto data = static_cast<const unsigned char*>(bytes);
+        for (unsigned i = 0; i < size; ++i)
+            WriteBits(data[i], 8);
+    }
+}
+
+void BitPackedOutputArchive::SerializeVLE(const char* name, unsigned& value)
+{
+    WriteVariableBits(value);
+}
+
+BitPackedInputArchive::BitPackedInputArchive(Context* context, const ByteVector& data, const QuantizationHints* hints)
+    : BitPackedArchiveBase(context, hints)
+    , data_(data)
+{
+}
+
+void BitPackedInputArchive::BeginSizedBlock()
+{
+    URHO3D_ASSERT(!sizedBlockOpen_);
+
+    const unsigned long long numBlockBits = ReadVariableBits();
+    if (numBlockBits > data_.size() * 8ull - bitPosition_)
+        throw ArchiveException("Unexpected end of bit-packed archive");
+
+    sizedBlockOpen_ = true;
+    sizedBlockEnd_ = bitPosition_ + numBlockBits;
+}
+
+void BitPackedInputArchive::EndSizedBlock()
+{
+    URHO3D_ASSERT(sizedBlockOpen_);
+    sizedBlockOpen_ = false;
+
+    if (bitPosition_ > sizedBlockEnd_)
+        throw ArchiveException("Bit-packed block is read past its end");
+    bitPosition_ = sizedBlockEnd_;
+}
+
+unsigned BitPackedInputArchive::ReadBits(unsigned numBits)
+{
+    URHO3D_ASSERT(numBits <= 32);
+    if (bitPosition_ + numBits > data_.size() * 8)
+    {
+        bitPosition_ = data_.size() * 8;
+        throw ArchiveException("Unexpected end of bit-packed archive");
+    }
+
+    unsigned long long result = 0;
+    unsigned numReadBits = 0;
+    while (numReadBits < numBits)
+    {
+        const auto byteIndex = static_cast<unsigned>(bitPosition_ / 8);
+        const auto bitOffset = static_cast<unsigned>(bitPosition_ % 8);
+        const unsigned numBitsInByte = ea::min(8 - bitOffset, numBits - numReadBits);
+
+        const unsigned bits = (data_[byteIndex] >> bitOffset) & ((1u << numBitsInByte) - 1);
+        result |= static_cast<unsigned long long>(bits) << numReadBits;
+
+        numReadBits += numBitsInByte;
+        bitPosition_ += numBitsInByte;
+    }
+    return static_cast<unsigned>(result);
+}
+
+unsigned long long BitPackedInputArchive::ReadVariableBits()
+{
+    unsigned long long result = 0;
+    unsigned shift = 0;
+    while (true)
+    {
+        const unsigned group = ReadBits(variableGroupBits + 1);
+        result |= static_cast<unsigned long long>(group & variableGroupMask) << shift;
+        if ((group >> variableGroupBits) == 0)
+            break;
+
+        shift += variableGroupBits;
+        if (shift >= 64)
+            throw ArchiveException("Invalid variable length integer in bit-packed archive");
+    }
+    return result;
+}
+
+long long BitPackedInputArchive::ReadSigned(const char* name)
+{
+    if (const QuantizationHint* hint = FindHint(name))
+        return static_cast<long long>(hint->min_) + ReadBits(hint->bits_);
+    else
+        return ZigZagDecode(ReadVariableBits());
+}
+
+unsigned long long BitPackedInputArchive::ReadUnsigned(const char* name)
+{
+    if (const QuantizationHint* hint = FindHint(name))
+        return static_cast<unsigned long long>(ea::max(0.0f, hint->min_)) + ReadBits(hint->bits_);
+    else
+        return ReadVariableBits();
+}
+
+void BitPackedInputArchive::BeginBlock(const char* name, unsigned& sizeHint, bool safe, ArchiveBlockType type)
+{
+    if (type == ArchiveBlockType::Array || type == ArchiveBlockType::Map)
+        sizeHint = static_cast<unsigned>(ReadVariableBits());
+}
+
+void BitPackedInputArchive::Serialize(const char* name, bool& value)
+{
+    value = ReadBits(1) != 0;
+}
+
+void BitPackedInputArchive::Serialize(const char* name, signed char& value)
+{
+    value = static_cast<signed char>(ReadSigned(name));
+}
+
+void BitPackedInputArchive::Serialize(const char* name, unsigned char& value)
+{
+    value = static_cast<unsigned char>(ReadUnsigned(name));
+}
+
+void BitPackedInputArchive::Serialize(const char* name, short& value)
+{
+    value = static_cast<short>(ReadSigned(name));
+}
+
+void BitPackedInputArchive::Serialize(const char* name, unsigned short& value)
+{
+    value = static_cast<unsigned short>(ReadUnsigned(name));
+}
+
+void BitPackedInputArchive::Serialize(const char* name, int& value)
+{
+    value = static_cast<int>(ReadSigned(name));
+}
+
+void BitPackedInputArchive::Serialize(const char* name, unsigned int& value)
+{
+    value = static_cast<unsigned>(ReadUnsigned(name));
+}
+
+void BitPackedInputArchive::Serialize(const char* name, long long& value)
+{
+    value = ReadSigned(name);
+}
+
+void BitPackedInputArchive::Serialize(const char* name, unsigned long long& value)
+{
+    value = ReadUnsigned(name);
+}
+
+void BitPackedInputArchive::Serialize(const char* name, float& value)
+{
+    if (const QuantizationHint* hint = FindHint(name))
+    {
+        value = static_cast<float>(DequantizeValue(ReadBits(hint->bits_), *hint));
+    }
+    else
+    {
+        const unsigned bits = ReadBits(32);
+        memcpy(&value, &bits, sizeof(value));
+    }
+}
+
+void BitPackedInputArchive::Serialize(const char* name, double& value)
+{
+    if (const QuantizationHint* hint = FindHint(name))
+    {
+        value = DequantizeValue(ReadBits(hint->bits_), *hint);
+        return;
+    }
+
+    const unsigned long long lowBits = ReadBits(32);
+    const unsigned long long highBits = ReadBits(32);
+    const unsigned long long bits = lowBits | (highBits << 32);
+    memcpy(&value, &bits, sizeof(value));
+}
+
+void BitPackedInputArchive::Serialize(const char* name, ea::string& value)
+{
+    const auto length = static_cast<unsigned>(ReadVariableBits());
+    if (bitPosition_ + length * 8ull > data_.size() * 8)
+        throw ArchiveException("Unexpected end of bit-packed archive");
+
+    value.resize(length);
+    for (unsigned i = 0; i < length; ++i)
+        value[i] = static_cast<char>(ReadBits(8));
+}
+
+void BitPackedInputArchive::SerializeBytes(const char* name, void* bytes, unsigned size)
+{
+    const QuantizationHint* hint = FindHint(name);
+    if (hint && size % sizeof(float) == 0)
+    {
+        const auto floats = static_cast<float*>(bytes);
+        for (unsigned i = 0; i < size / sizeof(float); ++i)
+            floats[i] = static_cast<float>(DequantizeValue(ReadBits(hint->bits_), *hint));
+    }
+    else
+    {
+        const auto data = static_cast<unsigned char*>(bytes);
+        for (unsigned i = 0; i < size; ++i)
+            data[i] = static_cast<unsigned char>(ReadBits(8));
+    }
+}
+
+void BitPackedInputArchive::SerializeVLE(const char* name, unsigned& value)
+{
+    value = static_cast<unsigned>(ReadVariableBits());
+}
+
+} // namespace Urho3D
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "_Plugin.h"
+
+#include <Urho3D/IO/Archive.h>
+
+#include <EASTL/unordered_map.h>
+
+namespace Urho3D
+{
+
+/// Quantization hint for floating point or integer field.
+/// Values are clamped to [min, max] range and stored using given number of bits.
+struct QuantizationHint
+{
+    float min_{};
+    float max_{};
+    unsigned bits_{};
+};
+
+/// Quantization hints grouped by scope (e.g. component type name) and field name.
+/// Hints in the group with empty name are applied to all scopes.
+using QuantizationHints = ea::unordered_map<ea::string, ea::unordered_map<ea::string, QuantizationHint>>;
+
+/// Base class for archives with bit-level packing.
+/// Integers are stored as variable length bit groups, booleans take single bit,
+/// floats, doubles and byte arrays of floats (e.g. vectors) are quantized according to hints.
+/// Regular blocks don't store sizes except for arrays and maps, so both sides are expected to serialize
+/// the same layout. Sized blocks are prefixed with their size in bits and can be skipped by the reader.
+class PLUGIN_CORE_ENTITYMANAGER_API BitPackedArchiveBase : public Archive
+{
+public:
+    BitPackedArchiveBase(Context* context, const QuantizationHints* hints);
+
+    /// Set scope of quantization hints for following elements.
+    void SetHintScope(const ea::string& scope);
+
+    /// Implement Archive.
+    /// @{
+    Context* GetContext() override { return context_; }
+    ea::string_view GetName() const override { return {}; }
+    unsigned GetChecksum() override { return 0; }
+    bool IsHumanReadable() const override { return false; }
+    bool IsUnorderedAccessSupportedInCurrentBlock() const override { return false; }
+    bool HasElementOrBlock(const char* name) const override { return false; }
+    ea::string GetCurrentBlockPath() const override { return {}; }
+    void EndBlock() noexcept override {}
+    void Flush() override {}
+    /// @}
+
+protected:
+    const QuantizationHint* FindHint(const char* name) const;
+
+    static unsigned GetMaxQuantizedValue(const QuantizationHint& hint);
+    static unsigned QuantizeValue(double value, const QuantizationHint& hint);
+    static double DequantizeValue(unsigned value, const QuantizationHint& hint);
+
+private:
+    Context* context_{};
+    const QuantizationHints* hints_{};
+    const ea::unordered_map<ea::string, QuantizationHint>* scopeHints_{};
+    const ea::unordered_map<ea::string, QuantizationHint>* globalHints_{};
+};
+
+/// Bit-packed output archive. Use GetData to get result.
+class PLUGIN_CORE_ENTITYMANAGER_API BitPackedOutputArchive : public BitPackedArchiveBase
+{
+public:
+    explicit BitPackedOutputArchive(Context* context, const QuantizationHints* hints = nullptr);
+
+    /// Return serialized data. Pending bits are padded to whole byte.
+    const ByteVector& GetData();
+    /// Reset archive for reuse.
+    void Clear();
+    /// Begin and end block prefixed with its size in bits. Sized blocks cannot be nested.
+    /// @{
+    void BeginSizedBlock();
+    void EndSizedBlock();
+    /// @}
+
+    /// Implement Archive.
+    /// @{
+    bool IsInput() const override { return false; }
+    bool IsEOF() const override { return false; }
+
+    void BeginBlock(const char* name, unsigned& sizeHint, bool safe, ArchiveBlockType type) override;
+
+    void Serialize(const char* name, bool& value) override;
+    void Serialize(const char* name, signed char& value) override;
+    void Serialize(const char* name, unsigned char& value) override;
+    void Serialize(const char* name, short& value) override;
+    void Serialize(const char* name, unsigned short& value) override;
+    void Serialize(const char* name, int& value) override;
+    void Serialize(const char* name, unsigned int& value) override;
+    void Serialize(const char* name, long long& value) override;
+    void Serialize(const char* name, unsigned long long& value) override;
+    void Serialize(const char* name, float& value) override;
+    void Serialize(const char* name, double& value) override;
+    void Serialize(const char* name, ea::string& value) override;
+
+    void SerializeBytes(const char* name, void* bytes, unsigned size) override;
+    void SerializeVLE(const char* name, unsigned& value) override;
+    /// @}
+
+private:
+    void WriteBits(unsigned value, unsigned numBits);
+    void WriteVariableBits(unsigned long long value);
+    void WriteSigned(const char* name, long long value);
+    void WriteUnsigned(const char* name, unsigned long long value);
+    void FlushBits();
+
+    ByteVector data_;
+    unsigned long long pendingBits_{};
+    unsigned numPendingBits_{};
+
+    /// Output that is suspended while sized block is written into data_. Buffer is retained for reuse.
+    /// @{
+    bool sizedBlockOpen_{};
+    ByteVector outerData_;
+    unsigned long long outerPendingBits_{};
+    unsigned outerNumPendingBits_{};
+    /// @}
+};
+
+/// Bit-packed input archive.
+class PLUGIN_CORE_ENTITYMANAGER_API BitPackedInputArchive : public BitPackedArchiveBase
+{
+public:
+    BitPackedInputArchive(Context* context, const ByteVector& data, const QuantizationHints* hints = nullptr);
+
+    /// Begin and end block prefixed with its size in bits.
+    /// Ending the block skips the remaining data, so the block may be left unread. Sized blocks cannot be nested.
+    /// @{
+    void BeginSizedBlock();
+    void EndSizedBlock();
+    /// @}
+
+    /// Implement Archive.
+    /// @{
+    bool IsInput() const override { return true; }
+    bool IsEOF() const override { return bitPosition_ >= data_.size() * 8; }
+
+    void BeginBlock(const char* name, unsigned& sizeHint, bool safe, ArchiveBlockType type) override;
+
+    void Serialize(const char* name, bool& value) override;
+    void Serialize(const char* name, signed char& value) override;
+    void Serialize(const char* name, unsigned char& value) override;
+    void Serialize(const char* name, short& value) override;
+    void Serialize(const char* name, unsigned short& value) override;
+    void Serialize(const char* name, int& value) override;
+    void Serialize(const char* name, unsigned int& value) override;
+    void Serialize(const char* name, long long& value) override;
+    void Serialize(const char* name, unsigned long long& value) override;
+    void Serialize(const char* name, float& value) override;
+    void Serialize(const char* name, double& value) override;
+    void Serialize(const char* name, ea::string& value) override;
+
+    void SerializeBytes(const char* name, void* bytes, unsigned size) override;
+    void SerializeVLE(const char* name, unsigned& value) override;
+    /// @}
+
+private:
+    unsigned ReadBits(unsigned numBits);
+    unsigned long long ReadVariableBits();
+    long long ReadSigned(const char* name);
+    unsigned long long ReadUnsigned(const char* name);
+
+    const ByteVector& data_;
+    unsigned long long bitPosition_{};
+    unsigned long long sizedBlockEnd_{};
+    bool sizedBlockOpen_{};
+};
+
+} // namespace Urho3D
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "EntityManager.h"
+
+#include <memory>
+#include <new>
+
+namespace Urho3D
+{
+
+/// Allocator of component storage pages aligned to Align bytes.
+/// Storage allocates components in pages of entt::component_traits<T>::page_size elements,
+/// so each page starts at aligned address and is padded to the whole page.
+/// Rebinding to any other type yields std::allocator so that the storage stays compatible with entt::registry.
+template <class T, unsigned Align> class EntityAlignedAllocator
+{
+public:
+    static_assert((Align & (Align - 1)) == 0, "Alignment should be power of two");
+    static_assert(Align >= alignof(T), "Alignment should not be less than natural alignment of component");
+
+    using value_type = T;
+
+    template <class U> struct rebind
+    {
+        using other = ea::conditional_t<std::is_same_v<U, T>, EntityAlignedAllocator<T, Align>, std::allocator<U>>;
+    };
+
+    EntityAlignedAllocator() = default;
+    template <class U> EntityAlignedAllocator(const std::allocator<U>&) {}
+    template <class U> operator std::allocator<U>() const { return {}; }
+
+    T* allocate(std::size_t count)
+    {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t{Align}));
+    }
+    void deallocate(T* ptr, std::size_t count) { ::operator delete(ptr, std::align_val_t{Align}); }
+
+    bool operator==(const EntityAlignedAllocator& rhs) const { return true; }
+    bool operator!=(const EntityAlignedAllocator& rhs) const { return false; }
+};
+
+template <class T, class Callback> void EntityManager::ForEachComponentChunk(const Callback& callback)
+{
+    static_assert(!std::is_empty_v<T>, "Empty components have no storage to iterate");
+    static_assert(!entt::component_traits<T>::in_place_delete, "Storage with tombstones cannot be iterated by chunks");
+
+    constexpr auto pageSize = static_cast<unsigned>(entt::component_traits<T>::page_size);
+
+    auto& storage = registry_.storage<T>();
+    const auto numComponents = static_cast<unsigned>(storage.size());
+    const entt::entity* entities = storage.data();
+    auto* pages = storage.raw();
+
+    for (unsigned first = 0; first < numComponents; first += pageSize)
+    {
+        const auto count = static_cast<eastl_size_t>(ea::min(pageSize, numComponents - first));
+        callback(ea::span<const entt::entity>{entities + first, count}, ea::span<T>{pages[first / pageSize], count});
+    }
+}
+
+} // namespace Urho3D
+
+/// Declare that storage of component T in entt::registry is allocated with Align-byte aligned pages.
+/// Should be used in global namespace before the storage of T is first accessed.
+#define URHO3D_ENTITY_ALIGNED_STORAGE(T, Align) \
+    namespace entt \
+    { \
+    template <> struct storage_type<T, entt::entity, std::allocator<T>> \
+    { \
+        using type = sigh_mixin<basic_storage<T, entt::entity, Urho3D::EntityAlignedAllocator<T, Align>>>; \
+    }; \
+    }
@@ -1,8 +1,13 @@
 #include "EntityManager.h"
 
 #include "EntityReference.h"
+#include "EntityValueIndex.h"
 
 #include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/Profiler.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/IO/ArchiveSerializationContainer.h>
 #include <Urho3D/IO/Base64Archive.h>
 #include <Urho3D/IO/MemoryBuffer.h>
 #include <Urho3D/Scene/Scene.h>
@@ -13,6 +18,10 @@
 
 #include <SDL_clipboard.h>
 
+#include <EASTL/shared_ptr.h>
+
+#include <thread>
+
 namespace Urho3D
 {
 
@@ -30,8 +39,59 @@ struct MaterializationStatus
     }
 };
 
+/// Tag of entities queued for destruction. Removed when the entity is connected to a node again.
+struct EntityDestroyPending
+{
+    void SerializeInBlock(Archive& archive, unsigned version) {}
+};
+
 const ea::string defaultContainerName = "Entities";
 
+/// Registry format versions:
+/// 0: Initial format without version.
+/// 1: Templates block.
+/// 2: Entities queued for destruction.
+const unsigned currentRegistryVersion = 2;
+const unsigned templatesRegistryVersion = 1;
+const unsigned destroyPendingRegistryVersion = 2;
+/// Binary data without version starts with number of entities, which cannot exceed entity index mask.
+/// Version is offset by this marker so that both kinds of data can be told apart.
+const unsigned registryVersionMarker = 1u << 28;
+
+const unsigned cacheLineSize = 64;
+const unsigned minParallelChunkSize = 256;
+const unsigned numParallelChunksPerThread = 4;
+
+unsigned GreatestCommonDivisor(unsigned lhs, unsigned rhs)
+{
+    while (rhs != 0)
+    {
+        const unsigned remainder = lhs % rhs;
+        lhs = rhs;
+        rhs = remainder;
+    }
+    return lhs;
+}
+
+/// State of parallel loop. Shared with worker tasks that may start after the loop is already finished.
+struct ParallelForState
+{
+    const ea::function<void(unsigned chunkIndex)>* callback_{};
+    unsigned numChunks_{};
+    std::atomic<unsigned> nextChunk_{};
+    std::atomic<unsigned> numCompletedChunks_{};
+
+    void ProcessChunks()
+    {
+        unsigned chunkIndex{};
+        while ((chunkIndex = nextChunk_.fetch_add(1, std::memory_order_relaxed)) < numChunks_)
+        {
+            (*callback_)(chunkIndex);
+            numCompletedChunks_.fetch_add(1, std::memory_order_release);
+        }
+    }
+};
+
 void FlattenEntityHierarchy(EntityReference* entityReference)
 {
     Node* node = entityReference->GetNode();
@@ -46,17 +106,109 @@ void FlattenEntityHierarchy(EntityReference* entityReference)
 
 } // namespace
 
+EntityReactiveQuery::EntityReactiveQuery(EntityComponentFactory* triggerType, bool onAdded, bool onUpdated,
+    const ea::vector<EntityComponentFactory*>& requiredTypes)
+    : triggerType_(triggerType)
+    , onAdded_(onAdded)
+    , onUpdated_(onUpdated)
+    , requiredTypes_(requiredTypes)
+{
+}
+
+ea::span<const entt::entity> EntityReactiveQuery::GetEntities() const
+{
+    return {entities_.data(), static_cast<eastl_size_t>(entities_.size())};
+}
+
+bool EntityReactiveQuery::IsMatching(entt::registry& registry, entt::entity entity) const
+{
+    if (!triggerType_->HasComponent(registry, entity))
+        return false;
+
+    for (EntityComponentFactory* factory : requiredTypes_)
+    {
+        if (!factory->HasComponent(registry, entity))
+            return false;
+    }
+    return true;
+}
+
+void EntityReactiveQuery::OnTriggered(entt::registry& registry, entt::entity entity)
+{
+    if (entities_.contains(entity))
+        return;
+
+    for (EntityComponentFactory* factory : requiredTypes_)
+    {
+        if (!factory->HasComponent(registry, entity))
+            return;
+    }
+
+    entities_.push(entity);
+}
+
+void EntityReactiveQuery::OnTriggerRemoved(entt::registry& registry, entt::entity entity)
+{
+    if (!collectRemoved_)
+        entities_.remove(entity);
+    else if (!entities_.contains(entity))
+        entities_.push(entity);
+}
+
+void EntityRemap::Add(entt::entity sourceEntity, entt::entity entity)
+{
+    const unsigned index = EntityManager::GetEntityIndex(sourceEntity);
+    if (index >= entities_.size())
+        entities_.resize(index + 1, ea::make_pair(entt::entity{entt::null}, entt::entity{entt::null}));
+    entities_[index] = ea::make_pair(sourceEntity, entity);
+}
+
+entt::entity EntityRemap::Remap(entt::entity sourceEntity) const
+{
+    if (sourceEntity == entt::null)
+        return entt::null;
+
+    const unsigned index = EntityManager::GetEntityIndex(sourceEntity);
+    if (index >= entities_.size() || entities_[index].first != sourceEntity)
+        return entt::null;
+    return entities_[index].second;
+}
+
 EntityComponentFactory::EntityComponentFactory(const ea::string& name)
     : name_(name)
 {
 }
 
+void EntityComponentFactory::MergeComponents(
+    entt::registry& registry, entt::registry& sourceRegistry, const EntityRemap& remap)
+{
+    URHO3D_LOGERROR("Component '{}' doesn't support registry merging", name_);
+}
+
+void EntityComponentFactory::CloneComponent(
+    entt::registry& registry, entt::entity entity, ea::span<const entt::entity> clones)
+{
+    URHO3D_LOGERROR("Component '{}' doesn't support cloning", name_);
+}
+
+bool EntityComponentFactory::ConnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query)
+{
+    URHO3D_LOGERROR("Component '{}' doesn't support reactive queries", name_);
+    return false;
+}
+
 EntityManager::EntityManager(Context* context)
     : TrackedComponentRegistryBase(context, EntityReference::GetTypeStatic())
     , entitiesContainerName_(defaultContainerName)
 {
 }
 
+EntityManager::~EntityManager()
+{
+    for (const auto& query : reactiveQueries_)
+        query->GetTriggerType()->DisconnectReactiveQuery(registry_, *query);
+}
+
 void EntityManager::RegisterObject(Context* context)
 {
     URHO3D_ATTRIBUTE("Entities Container Node", ea::string, entitiesContainerName_, defaultContainerName, AM_DEFAULT);
@@ -99,7 +251,7 @@ bool EntityManager::RenderManagerInspector()
     }
     if (ui::BeginListBox("##Entities"))
     {
-        for (const auto& [entity] : registry_.storage<entt::entity>().each())
+        for (const entt::entity entity : GetEntities())
         {
             const IdScopeGuard guard{entt::to_integral(entity)};
             const ea::string label = GetEntityLabel(entity);
@@ -119,6 +271,31 @@ bool EntityManager::RenderManagerInspector()
         MaterializeEntity(entity);
     }
 
+    if (!groups_.empty())
+    {
+        {
+            ColorScopeGuard colorScopeGuard{ImGuiCol_Text, Color::YELLOW};
+            ui::Text("Groups:");
+        }
+        for (const GroupDesc& group : groups_)
+            ui::Text("%s: %u entities", group.name_.c_str(), group.getSize_(registry_));
+    }
+
+    {
+        ColorScopeGuard colorScopeGuard{ImGuiCol_Text, Color::YELLOW};
+        ui::Text("Last Frame Statistics:");
+    }
+    ui::Text("Entities: %u (%u materialized)", static_cast<unsigned>(GetEntities().size()),
+        static_cast<unsigned>(GetMaterializedEntities().size()));
+    ui::Text("Materialized: %u, Dematerialized: %u, Destroyed: %u", lastFrameStats_.numEntitiesMaterialized_,
+        lastFrameStats_.numEntitiesDematerialized_, lastFrameStats_.numEntitiesDestroyed_);
+    ui::Text("Decodes Queued: %u, Processed: %u", lastFrameStats_.numDecodesQueued_,
+        lastFrameStats_.numDecodesProcessed_);
+    ui::Text("Bytes Encoded: %u, Decoded: %u", lastFrameStats_.numBytesEncoded_, lastFrameStats_.numBytesDecoded_);
+    ui::Text("Transient Components Cleared: %u", lastFrameStats_.numTransientComponentsCleared_);
+    ui::Text("Components Spatially Sorted: %u", lastFrameStats_.numComponentsSpatiallySorted_);
+    ui::Text("Synchronize: %.3f ms", lastFrameStats_.synchronizeTimeUs_ / 1000.0f);
+
     ui::Unindent();
     return changed;
 }
@@ -168,6 +345,10 @@ void EntityManager::RenderEntityHeader(entt::entity entity)
         SDL_SetClipboardText(Format("{}", static_cast<unsigned>(entity)).c_str());
     if (ui::IsItemHovered())
         ui::SetTooltip("Copy entity ID to clipboard");
+
+    const entt::entity templateEntity = GetEntityTemplate(entity);
+    if (templateEntity != entt::null)
+        ui::Text("Instance of template %s", Format("{}", templateEntity).c_str());
 }
 
 EntityComponentFactory* EntityManager::RenderCreateComponent(entt::entity entity)
@@ -240,8 +421,16 @@ bool EntityManager::RenderExistingComponents(entt::entity entity)
 
 void EntityManager::AddComponentType(ea::unique_ptr<EntityComponentFactory> factory)
 {
+    if (!factory->IsSnapshotSupported())
+        URHO3D_LOGERROR("Component '{}' doesn't support snapshots and will not be restored", factory->GetName());
+
+    factory->Initialize(registry_);
     componentFactories_.push_back(ea::move(factory));
     componentTypesSorted_ = false;
+
+    // Snapshot layout depends on the set of component types.
+    for (Snapshot& snapshot : snapshots_)
+        snapshot.valid_ = false;
 }
 
 EntityComponentFactory* EntityManager::FindComponentType(ea::string_view name) const
@@ -254,8 +443,87 @@ EntityComponentFactory* EntityManager::FindComponentType(ea::string_view name) c
     return nullptr;
 }
 
+EntityReactiveQuery* EntityManager::CreateReactiveQuery(
+    ea::string_view triggerType, bool onAdded, bool onUpdated, const StringVector& requiredTypes)
+{
+    EntityComponentFactory* triggerFactory = FindComponentType(triggerType);
+    if (!triggerFactory)
+    {
+        URHO3D_LOGERROR("Cannot create reactive query for unknown component '{}'", triggerType);
+        return nullptr;
+    }
+
+    if (!onAdded && !onUpdated)
+    {
+        URHO3D_LOGERROR("Reactive query for component '{}' should be triggered on addition or update", triggerType);
+        return nullptr;
+    }
+
+    ea::vector<EntityComponentFactory*> requiredFactories;
+    for (const ea::string& typeName : requiredTypes)
+    {
+        EntityComponentFactory* factory = FindComponentType(typeName);
+        if (!factory)
+        {
+            URHO3D_LOGERROR("Cannot create reactive query with unknown required component '{}'", typeName);
+            return nullptr;
+        }
+
+        // Trigger component and duplicates would be checked for nothing on each trigger.
+        if (factory == triggerFactory
+            || ea::find(requiredFactories.begin(), requiredFactories.end(), factory) != requiredFactories.end())
+        {
+            URHO3D_LOGERROR("Cannot create reactive query with redundant required component '{}'", typeName);
+            return nullptr;
+        }
+        requiredFactories.push_back(factory);
+    }
+
+    auto query = ea::make_unique<EntityReactiveQuery>(triggerFactory, onAdded, onUpdated, requiredFactories);
+    if (!triggerFactory->ConnectReactiveQuery(registry_, *query))
+        return nullptr;
+
+    reactiveQueries_.push_back(ea::move(query));
+    return reactiveQueries_.back().get();
+}
+
+void EntityManager::RemoveReactiveQuery(EntityReactiveQuery* query)
+{
+    const auto iter = ea::find_if(reactiveQueries_.begin(), reactiveQueries_.end(),
+        [query](const auto& existingQuery) { return existingQuery.get() == query; });
+    if (iter == reactiveQueries_.end())
+    {
+        URHO3D_LOGERROR("Cannot remove unknown reactive query");
+        return;
+    }
+
+    query->GetTriggerType()->DisconnectReactiveQuery(registry_, *query);
+    reactiveQueries_.erase(iter);
+}
+
+void EntityManager::RemoveValueIndex(EntityValueIndexBase* index)
+{
+    const auto iter = ea::find_if(valueIndices_.begin(), valueIndices_.end(),
+        [index](const auto& valueIndex) { return valueIndex.get() == index; });
+    if (iter == valueIndices_.end())
+    {
+        URHO3D_LOGERROR("Cannot remove unknown value index");
+        return;
+    }
+
+    valueIndices_.erase(iter);
+}
+
+const ea::vector<ea::unique_ptr<EntityComponentFactory>>& EntityManager::GetComponentTypes()
+{
+    EnsureComponentTypesSorted();
+    return componentFactories_;
+}
+
 void EntityManager::CommitActions()
 {
+    URHO3D_PROFILE("EntityManager::CommitActions");
+
     if (!ui_.pendingMaterializations_.empty())
     {
         for (const auto& [entity, isMaterialized] : ui_.pendingMaterializations_)
@@ -333,7 +601,12 @@ void EntityManager::OnComponentRemoved(TrackedComponentBase* baseComponent)
     if (entity != entt::null)
     {
         URHO3D_ASSERT(registry_.valid(entity));
-        registry_.destroy(entity);
+
+        // Node is gone now, the entity itself is destroyed in batch later.
+        if (EntityToReference(entity) == entityReference)
+            registry_.remove<EntityMaterialized>(entity);
+        registry_.emplace_or_replace<MaterializationStatus>(entity, MaterializationStatus{false});
+        QueueDestroyEntity(entity);
     }
 }
 
@@ -345,6 +618,11 @@ void EntityManager::OnAddedToScene(Scene* scene)
 void EntityManager::OnRemovedFromScene()
 {
     UnsubscribeFromEvent(E_SCENEFORCEDPOSTUPDATE);
+
+    // References stay in the old scene and may be destroyed there, so links to them are dropped.
+    // Materialized entities are connected or materialized again on the next synchronization.
+    registry_.clear<EntityMaterialized>();
+    registryDirty_ = true;
 }
 
 void EntityManager::Synchronize()
@@ -353,6 +631,9 @@ void EntityManager::Synchronize()
         return;
     synchronizationInProgress_ = true;
 
+    URHO3D_PROFILE("EntityManager::Synchronize");
+    HiresTimer timer;
+
     for (EntityReference* entityReference : pendingEntitiesAdded_)
     {
         // If registry has spawned this entity, everything is already configured.
@@ -363,6 +644,8 @@ void EntityManager::Synchronize()
         if (registry_.valid(entityHint) && EntityToReference(entityHint) == nullptr)
         {
             // If entity is known to the registry and is not yet connected, connect to it.
+            // Entity may be queued for destruction if the node was removed earlier, it is alive again.
+            registry_.remove<EntityDestroyPending>(entityHint);
         }
         else
         {
@@ -371,14 +654,17 @@ void EntityManager::Synchronize()
         }
 
         const entt::entity entity = entityReference->Entity();
-        registry_.emplace<EntityMaterialized>(entity, WeakPtr<EntityReference>{entityReference});
+        registry_.emplace<EntityMaterialized>(entity, entityReference);
     }
     pendingEntitiesAdded_.clear();
 
     for (const auto& [entityReference, data] : pendingEntityDecodes_)
     {
         if (entityReference && entityReference->Entity() != entt::null)
+        {
             DecodeEntity(entityReference->Entity(), data);
+            ++frameStats_.numDecodesProcessed_;
+        }
     }
     pendingEntityDecodes_.clear();
 
@@ -388,6 +674,7 @@ void EntityManager::Synchronize()
         EnsureEntitiesMaterialized();
     }
 
+    frameStats_.synchronizeTimeUs_ += timer.GetUSec(false);
     synchronizationInProgress_ = false;
 }
 
@@ -405,7 +692,7 @@ bool EntityManager::IsEntityValid(entt::entity entity) const
 EntityReference* EntityManager::EntityToReference(entt::entity entity) const
 {
     const auto data = entity != entt::null ? registry_.try_get<EntityMaterialized>(entity) : nullptr;
-    return data ? data->entityReference_.Get() : nullptr;
+    return data ? data->entityReference_ : nullptr;
 }
 
 Node* EntityManager::EntityToNode(entt::entity entity) const
@@ -436,6 +723,8 @@ entt::entity EntityManager::VariantToEntity(const Variant& variant)
 
 void EntityManager::EnsureEntitiesMaterialized()
 {
+    URHO3D_PROFILE("EntityManager::EnsureEntitiesMaterialized");
+
     for (const auto& [entity] : registry_.storage<entt::entity>().each())
     {
         const auto* status = registry_.try_get<MaterializationStatus>(entity);
@@ -461,14 +750,16 @@ EntityReference* EntityManager::MaterializeEntity(entt::entity entity)
     auto entityReference = MakeShared<EntityReference>(context_);
     entityReference->SetEntityInternal(entity);
 
-    registry_.emplace_or_replace<EntityMaterialized>(entity, WeakPtr<EntityReference>{entityReference});
+    registry_.emplace_or_replace<EntityMaterialized>(entity, entityReference.Get());
     registry_.emplace_or_replace<MaterializationStatus>(entity, MaterializationStatus{true});
+    registry_.remove<EntityDestroyPending>(entity);
 
     suppressComponentEvents_ = true;
     entityNode->AddComponent(entityReference, 0);
     suppressComponentEvents_ = false;
 
     OnEntityMaterialized(this, registry_, entity, entityReference);
+    ++frameStats_.numEntitiesMaterialized_;
 
     URHO3D_ASSERT(IsEntityMaterialized(entity));
 
@@ -498,17 +789,227 @@ void EntityManager::DematerializeEntity(entt::entity entity)
 
     registry_.remove<EntityMaterialized>(entity);
     registry_.emplace_or_replace<MaterializationStatus>(entity, MaterializationStatus{false});
+    ++frameStats_.numEntitiesDematerialized_;
 }
 
-ea::vector<entt::entity> EntityManager::GetEntities() const
+void EntityManager::QueueDestroyEntity(entt::entity entity)
 {
-    ea::vector<entt::entity> result;
+    if (!IsEntityValid(entity))
+        return;
+
+    registry_.emplace_or_replace<EntityDestroyPending>(entity);
+    pendingEntityDestroys_.push_back(entity);
+}
+
+void EntityManager::DestroyQueuedEntities()
+{
+    if (pendingEntityDestroys_.empty())
+        return;
+
+    URHO3D_PROFILE("EntityManager::DestroyQueuedEntities");
+
+    // Entities queued by listeners during destruction are processed next time.
+    auto& entities = destroyedEntitiesBuffer_;
+    entities.swap(pendingEntityDestroys_);
+
+    // Only one version of entity can be valid, so duplicates are adjacent after sorting.
+    // Entities connected to a node again after they were queued are not pending anymore.
+    const auto isCancelled = [this](entt::entity entity)
+    { return !IsEntityValid(entity) || !registry_.all_of<EntityDestroyPending>(entity); };
+    entities.erase(ea::remove_if(entities.begin(), entities.end(), isCancelled), entities.end());
+    ea::sort(entities.begin(), entities.end(), EntityIndexComparator{});
+    entities.erase(ea::unique(entities.begin(), entities.end()), entities.end());
+
+    for (const entt::entity entity : entities)
+    {
+        if (IsEntityMaterialized(entity))
+            DematerializeEntity(entity);
+    }
+
+    // Range destruction removes components storage by storage and recycles identifiers in bulk.
+    registry_.destroy(entities.begin(), entities.end());
+
+    frameStats_.numEntitiesDestroyed_ += entities.size();
+    entities.clear();
+}
+
+ea::span<const entt::entity> EntityManager::GetEntities() const
+{
+    // Entities in use are always stored at the beginning of the entity storage.
     if (const auto* storage = registry_.storage<entt::entity>())
+        return {storage->data(), static_cast<eastl_size_t>(storage->in_use())};
+    return {};
+}
+
+ea::span<const entt::entity> EntityManager::GetMaterializedEntities() const
+{
+    if (const auto* storage = registry_.storage<EntityMaterialized>())
+        return {storage->data(), static_cast<eastl_size_t>(storage->size())};
+    return {};
+}
+
+ea::span<const entt::entity> EntityManager::GetEntitiesChunk(
+    ea::span<const entt::entity> entities, unsigned chunkIndex, unsigned chunkSize)
+{
+    URHO3D_ASSERT(chunkSize > 0);
+
+    const auto numEntities = static_cast<unsigned>(entities.size());
+    const unsigned begin = ea::min(chunkIndex * chunkSize, numEntities);
+    const unsigned end = ea::min(begin + chunkSize, numEntities);
+    return entities.subspan(begin, end - begin);
+}
+
+unsigned EntityManager::GetNumEntitiesChunks(ea::span<const entt::entity> entities, unsigned chunkSize)
+{
+    URHO3D_ASSERT(chunkSize > 0);
+    return (static_cast<unsigned>(entities.size()) + chunkSize - 1) / chunkSize;
+}
+
+EntityRemap EntityManager::MergeRegistry(entt::registry& sourceRegistry)
+{
+    URHO3D_PROFILE("EntityManager::MergeRegistry");
+
+    EntityRemap remap;
+    if (&sourceRegistry == &registry_)
     {
-        for (const auto& [entity] : storage->each())
-            result.push_back(entity);
+        URHO3D_LOGERROR("Cannot merge registry into itself");
+        return remap;
     }
-    return result;
+
+    const auto& sourceEntityStorage = sourceRegistry.storage<entt::entity>();
+    const ea::span<const entt::entity> sourceEntities{
+        sourceEntityStorage.data(), static_cast<eastl_size_t>(sourceEntityStorage.in_use())};
+
+    static thread_local ea::vector<entt::entity> entitiesBuffer;
+    auto& entities = entitiesBuffer;
+
+    entities.resize(sourceEntities.size());
+    registry_.create(entities.begin(), entities.end());
+    for (unsigned i = 0; i < sourceEntities.size(); ++i)
+        remap.Add(sourceEntities[i], entities[i]);
+
+    for (const auto& [sourceEntity, status] : sourceRegistry.storage<MaterializationStatus>().each())
+        registry_.emplace<MaterializationStatus>(remap.Remap(sourceEntity), status);
+
+    for (const auto& factory : componentFactories_)
+        factory->MergeComponents(registry_, sourceRegistry, remap);
+
+    for (const auto& [sourceEntity, templateRef] : sourceRegistry.storage<EntityTemplateRef>().each())
+    {
+        const entt::entity templateEntity = remap.Remap(templateRef.template_);
+        if (templateEntity != entt::null)
+            registry_.emplace<EntityTemplateRef>(remap.Remap(sourceEntity), templateEntity);
+    }
+
+    registryDirty_ = true;
+    return remap;
+}
+
+ea::vector<entt::entity> EntityManager::CloneEntity(entt::entity entity, unsigned count)
+{
+    if (!IsEntityValid(entity))
+    {
+        URHO3D_LOGERROR("Cannot clone entity {}", entity);
+        return {};
+    }
+
+    URHO3D_PROFILE("EntityManager::CloneEntity");
+
+    ea::vector<entt::entity> clones(count);
+    registry_.create(clones.begin(), clones.end());
+
+    for (const auto& factory : componentFactories_)
+        factory->CloneComponent(registry_, entity, clones);
+
+    if (const auto status = registry_.try_get<MaterializationStatus>(entity))
+    {
+        const MaterializationStatus value = *status;
+        registry_.insert<MaterializationStatus>(clones.begin(), clones.end(), value);
+    }
+
+    if (const auto templateRef = registry_.try_get<EntityTemplateRef>(entity))
+    {
+        const EntityTemplateRef value = *templateRef;
+        registry_.insert<EntityTemplateRef>(clones.begin(), clones.end(), value);
+    }
+
+    if (IsEntityMaterialized(entity))
+    {
+        for (const entt::entity clone : clones)
+            MaterializeEntity(clone);
+    }
+
+    return clones;
+}
+
+ea::vector<entt::entity> EntityManager::InstantiateTemplate(entt::entity templateEntity, unsigned count)
+{
+    if (!IsEntityValid(templateEntity))
+    {
+        URHO3D_LOGERROR("Cannot instantiate template {}", templateEntity);
+        return {};
+    }
+
+    URHO3D_PROFILE("EntityManager::InstantiateTemplate");
+
+    ea::vector<entt::entity> instances(count);
+    registry_.create(instances.begin(), instances.end());
+
+    for (const auto& factory : componentFactories_)
+        factory->CloneComponent(registry_, templateEntity, instances);
+
+    registry_.insert<EntityTemplateRef>(instances.begin(), instances.end(), EntityTemplateRef{templateEntity});
+
+    for (const entt::entity instance : instances)
+        MaterializeEntity(instance);
+
+    return instances;
+}
+
+void EntityManager::SetEntityTemplate(entt::entity entity, entt::entity templateEntity)
+{
+    if (!IsEntityValid(entity) || entity == templateEntity)
+    {
+        URHO3D_LOGERROR("Cannot set template {} of entity {}", templateEntity, entity);
+        return;
+    }
+
+    if (templateEntity == entt::null)
+    {
+        registry_.remove<EntityTemplateRef>(entity);
+        return;
+    }
+
+    if (!IsEntityValid(templateEntity))
+    {
+        URHO3D_LOGERROR("Cannot set template {} of entity {}", templateEntity, entity);
+        return;
+    }
+
+    // Instances skip components equal to template ones on save, so cycles would lose these components.
+    for (entt::entity parentEntity = GetEntityTemplate(templateEntity); parentEntity != entt::null;
+         parentEntity = GetEntityTemplate(parentEntity))
+    {
+        if (parentEntity == entity)
+        {
+            URHO3D_LOGERROR("Cannot set template {} of entity {}: templates cannot be cyclic", templateEntity, entity);
+            return;
+        }
+    }
+
+    registry_.emplace_or_replace<EntityTemplateRef>(entity, templateEntity);
+}
+
+entt::entity EntityManager::FindValidTemplate(const entt::registry& registry, entt::entity entity)
+{
+    const auto templateRef = registry.try_get<EntityTemplateRef>(entity);
+    return templateRef && registry.valid(templateRef->template_) ? templateRef->template_ : entt::null;
+}
+
+entt::entity EntityManager::GetEntityTemplate(entt::entity entity) const
+{
+    const auto templateRef = entity != entt::null ? registry_.try_get<EntityTemplateRef>(entity) : nullptr;
+    return templateRef ? templateRef->template_ : entt::null;
 }
 
 ByteVector EntityManager::EncodeEntity(entt::registry& registry, entt::entity entity)
@@ -522,20 +1023,54 @@ ByteVector EntityManager::EncodeEntity(entt::registry& registry, entt::entity en
     VectorBuffer buffer;
     BinaryOutputArchive archive{context_, buffer};
     SerializeStandaloneEntity(archive, registry, entity);
+    frameStats_.numBytesEncoded_ += buffer.GetSize();
     return buffer.GetBuffer();
 }
 
-void EntityManager::DecodeEntity(entt::registry& registry, entt::entity entity, const ByteVector& data)
+bool EntityManager::DecodeEntity(entt::registry& registry, entt::entity entity, const ByteVector& data)
 {
     if (!registry.valid(entity))
     {
         URHO3D_LOGERROR("Cannot decode entity {}", entity);
-        return;
+        return false;
     }
 
     MemoryBuffer buffer{data};
     BinaryInputArchive archive{context_, buffer};
-    SerializeStandaloneEntity(archive, registry, entity);
+    const bool success = ConsumeArchiveException([&] { SerializeStandaloneEntity(archive, registry, entity); });
+    frameStats_.numBytesDecoded_ += data.size();
+    return success;
+}
+
+ByteVector EntityManager::EncodeEntity(entt::registry& registry, entt::entity entity, const QuantizationHints& hints)
+{
+    if (!registry.valid(entity))
+    {
+        URHO3D_LOGERROR("Cannot encode entity {}", entity);
+        return {};
+    }
+
+    BitPackedOutputArchive archive{context_, &hints};
+    EncodeBitPackedEntity(archive, registry, entity);
+
+    const ByteVector& data = archive.GetData();
+    frameStats_.numBytesEncoded_ += data.size();
+    return data;
+}
+
+bool EntityManager::DecodeEntity(
+    entt::registry& registry, entt::entity entity, const ByteVector& data, const QuantizationHints& hints)
+{
+    if (!registry.valid(entity))
+    {
+        URHO3D_LOGERROR("Cannot decode entity {}", entity);
+        return false;
+    }
+
+    BitPackedInputArchive archive{context_, data, &hints};
+    const bool success = ConsumeArchiveException([&] { DecodeBitPackedEntity(archive, registry, entity); });
+    frameStats_.numBytesDecoded_ += data.size();
+    return success;
 }
 
 ByteVector EntityManager::EncodeEntity(entt::entity entity)
@@ -543,14 +1078,15 @@ ByteVector EntityManager::EncodeEntity(entt::entity entity)
     return EncodeEntity(registry_, entity);
 }
 
-void EntityManager::DecodeEntity(entt::entity entity, const ByteVector& data)
+bool EntityManager::DecodeEntity(entt::entity entity, const ByteVector& data)
 {
-    DecodeEntity(registry_, entity, data);
+    return DecodeEntity(registry_, entity, data);
 }
 
 void EntityManager::QueueDecodeEntity(EntityReference* entityReference, const ByteVector& data)
 {
     pendingEntityDecodes_.emplace_back(WeakPtr<EntityReference>{entityReference}, data);
+    ++frameStats_.numDecodesQueued_;
 }
 
 void EntityManager::SetDataAttr(const ByteVector& data)
@@ -559,18 +1095,24 @@ void EntityManager::SetDataAttr(const ByteVector& data)
     BinaryInputArchive archive(context_, buffer);
     SerializeRegistry(archive);
     registryDirty_ = true;
+    frameStats_.numBytesDecoded_ += data.size();
 }
 
 ByteVector EntityManager::GetDataAttr() const
 {
+    auto self = const_cast<EntityManager*>(this);
+
     VectorBuffer buffer;
     BinaryOutputArchive archive(context_, buffer);
-    const_cast<EntityManager*>(this)->SerializeRegistry(archive);
+    self->SerializeRegistry(archive);
+    self->frameStats_.numBytesEncoded_ += buffer.GetSize();
     return buffer.GetBuffer();
 }
 
 void EntityManager::SerializeRegistry(Archive& archive)
 {
+    URHO3D_PROFILE("EntityManager::SerializeRegistry");
+
     ea::vector<EntityMaterialized> entityReferences;
 
     if (archive.IsInput())
@@ -579,19 +1121,33 @@ void EntityManager::SerializeRegistry(Archive& archive)
             entityReferences.push_back(data);
 
         registry_.clear();
+        pendingEntityDestroys_.clear();
     }
 
     ConsumeArchiveException(
         [&]
     {
         const auto block = archive.OpenUnorderedBlock("registry");
-        SerializeEntities(archive);
+        unsigned legacyNumEntities = M_MAX_UNSIGNED;
+        const unsigned version = SerializeRegistryVersion(archive, legacyNumEntities);
+        SerializeEntities(archive, legacyNumEntities);
         SerializeComponents<MaterializationStatus>(archive, "materializationStatus", registry_, 0);
         SerializeUserComponents(archive);
+        if (version >= templatesRegistryVersion)
+            SerializeTemplates(archive);
+        // Saving is free of side effects, so queued entities are saved as pending and queued again on load.
+        if (version >= destroyPendingRegistryVersion)
+            SerializeComponents<EntityDestroyPending>(archive, "destroyPending", registry_, 0);
     });
 
     if (archive.IsInput())
     {
+        for (const auto& factory : componentFactories_)
+            factory->OnRegistryLoaded(registry_);
+
+        const auto pendingEntities = registry_.view<EntityDestroyPending>();
+        pendingEntityDestroys_.assign(pendingEntities.begin(), pendingEntities.end());
+
         for (const auto& data : entityReferences)
         {
             const entt::entity entity = data.entityReference_->Entity();
@@ -601,8 +1157,197 @@ void EntityManager::SerializeRegistry(Archive& archive)
     }
 }
 
-void EntityManager::SerializeEntities(Archive& archive)
+void EntityManager::SetMaxSnapshots(unsigned maxSnapshots)
+{
+    snapshots_.clear();
+    snapshots_.resize(maxSnapshots);
+    nextSnapshotIndex_ = 0;
+}
+
+void EntityManager::SaveSnapshot(unsigned tick)
+{
+    if (snapshots_.empty())
+    {
+        URHO3D_LOGERROR("Cannot save snapshot for tick {}: snapshot buffer is empty", tick);
+        return;
+    }
+
+    URHO3D_PROFILE("EntityManager::SaveSnapshot");
+
+    Snapshot& snapshot = snapshots_[nextSnapshotIndex_];
+    nextSnapshotIndex_ = (nextSnapshotIndex_ + 1) % snapshots_.size();
+
+    // Buffers are reused between snapshots to avoid reallocations.
+    if (!snapshot.data_)
+        snapshot.data_ = ea::make_unique<VectorBuffer>();
+    snapshot.data_->Clear();
+
+    BinaryOutputArchive archive{context_, *snapshot.data_};
+    SerializeSnapshot(archive);
+
+    snapshot.tick_ = tick;
+    snapshot.valid_ = true;
+}
+
+bool EntityManager::RestoreSnapshot(unsigned tick)
+{
+    const auto iter = ea::find_if(snapshots_.begin(), snapshots_.end(),
+        [tick](const Snapshot& snapshot) { return snapshot.valid_ && snapshot.tick_ == tick; });
+    if (iter == snapshots_.end())
+    {
+        URHO3D_LOGERROR("Cannot restore snapshot for tick {}", tick);
+        return false;
+    }
+
+    URHO3D_PROFILE("EntityManager::RestoreSnapshot");
+
+    MemoryBuffer buffer{iter->data_->GetBuffer()};
+    BinaryInputArchive archive{context_, buffer};
+    SerializeSnapshot(archive);
+    return true;
+}
+
+bool EntityManager::HasSnapshot(unsigned tick) const
+{
+    return ea::any_of(snapshots_.begin(), snapshots_.end(),
+        [tick](const Snapshot& snapshot) { return snapshot.valid_ && snapshot.tick_ == tick; });
+}
+
+void EntityManager::SerializeSnapshot(Archive& archive)
+{
+    EnsureComponentTypesSorted();
+
+    bool materializationChanged = false;
+    ConsumeArchiveException(
+        [&]
+    {
+        const auto block = archive.OpenUnorderedBlock("snapshot");
+        if (SerializeSnapshotEntities(archive))
+            materializationChanged = true;
+        if (SerializeComponentsSnapshot<MaterializationStatus>(archive, registry_))
+            materializationChanged = true;
+        SerializeComponentsSnapshot<EntityTemplateRef>(archive, registry_);
+        SerializeComponentsSnapshot<EntityDestroyPending>(archive, registry_);
+
+        // Unsupported factories are reported once on registration and write nothing, so layout stays the same.
+        for (const auto& factory : componentFactories_)
+        {
+            const auto storageBlock = archive.OpenUnorderedBlock("storage");
+            if (factory->IsSnapshotSupported())
+                factory->SerializeSnapshot(archive, registry_);
+        }
+    });
+
+    if (archive.IsInput())
+    {
+        // Destruction queue is rebuilt from restored pending tags.
+        const auto pendingEntities = registry_.view<EntityDestroyPending>();
+        pendingEntityDestroys_.assign(pendingEntities.begin(), pendingEntities.end());
+    }
+
+    if (materializationChanged)
+        EnsureEntitiesMaterialized();
+}
+
+bool EntityManager::SerializeSnapshotEntities(Archive& archive)
+{
+    static thread_local ea::vector<entt::entity> entitiesBuffer;
+    auto& entities = entitiesBuffer;
+
+    const auto currentEntities = GetEntities();
+    auto numEntities = static_cast<unsigned>(currentEntities.size());
+    archive.SerializeVLE("numEntities", numEntities);
+
+    if (!archive.IsInput())
+    {
+        entities.assign(currentEntities.begin(), currentEntities.end());
+        archive.SerializeBytes("entities", entities.data(), numEntities * sizeof(entt::entity));
+        return false;
+    }
+
+    entities.resize(numEntities);
+    archive.SerializeBytes("entities", entities.data(), numEntities * sizeof(entt::entity));
+
+    snapshotEntitiesSet_.clear();
+    snapshotEntitiesSet_.push(entities.begin(), entities.end());
+
+    // Destroy entities created after the snapshot. Span is invalidated by destruction, so collect them first.
+    static thread_local ea::vector<entt::entity> removedEntitiesBuffer;
+    auto& removedEntities = removedEntitiesBuffer;
+    removedEntities.clear();
+    for (const entt::entity entity : currentEntities)
+    {
+        if (!snapshotEntitiesSet_.contains(entity))
+            removedEntities.push_back(entity);
+    }
+
+    for (const entt::entity entity : removedEntities)
+    {
+        if (IsEntityMaterialized(entity))
+            DematerializeEntity(entity);
+        registry_.destroy(entity);
+    }
+
+    // Recreate entities destroyed after the snapshot with the same identifiers.
+    bool entitiesCreated = false;
+    for (const entt::entity entity : entities)
+    {
+        if (!registry_.valid(entity))
+        {
+            const entt::entity createdEntity = registry_.create(entity);
+            URHO3D_ASSERT(createdEntity == entity);
+            entitiesCreated = true;
+        }
+    }
+
+    return entitiesCreated || !removedEntities.empty();
+}
+
+unsigned EntityManager::SerializeRegistryVersion(Archive& archive, unsigned& legacyNumEntities)
+{
+    static_assert(entt::entt_traits<entt::entity>::entity_mask < registryVersionMarker);
+
+    if (!archive.IsInput())
+    {
+        unsigned versionData = registryVersionMarker + currentRegistryVersion;
+        archive.SerializeVLE("version", versionData);
+        return currentRegistryVersion;
+    }
+
+    if (archive.IsUnorderedAccessSupportedInCurrentBlock() && !archive.HasElementOrBlock("version"))
+        return 0;
+
+    unsigned versionData = 0;
+    archive.SerializeVLE("version", versionData);
+    if (versionData < registryVersionMarker)
+    {
+        if (archive.IsUnorderedAccessSupportedInCurrentBlock())
+            throw ArchiveException("Invalid registry version {}", versionData);
+
+        legacyNumEntities = versionData;
+        return 0;
+    }
+
+    const unsigned version = versionData - registryVersionMarker;
+    if (version > currentRegistryVersion)
+        throw ArchiveException("Unsupported registry version {}", version);
+    return version;
+}
+
+void EntityManager::SerializeEntities(Archive& archive, unsigned legacyNumEntities)
 {
+    // Number of entities in legacy binary data is already read as registry version.
+    if (archive.IsInput() && legacyNumEntities != M_MAX_UNSIGNED)
+    {
+        for (unsigned i = 0; i < legacyNumEntities; ++i)
+        {
+            unsigned entityData = 0;
+            archive.Serialize("entity", entityData);
+            (void)registry_.create(static_cast<entt::entity>(entityData));
+        }
+        return;
+    }
+
     const auto numEntities = static_cast<unsigned>(registry_.storage<entt::entity>().in_use());
     const auto block = archive.OpenArrayBlock("entities", numEntities);
     if (archive.IsInput())
@@ -619,9 +1364,8 @@ void EntityManager::SerializeEntities(Archive& archive)
         static thread_local ea::vector<entt::entity> entitiesBuffer;
         auto& entities = entitiesBuffer;
 
-        entities.clear();
-        for (const auto& [entity] : registry_.storage<entt::entity>().each())
-            entities.push_back(entity);
+        const auto allEntities = GetEntities();
+        entities.assign(allEntities.begin(), allEntities.end());
         ea::sort(entities.begin(), entities.end(), EntityIndexComparator{});
 
         for (const entt::entity entity : entities)
@@ -671,6 +1415,185 @@ void EntityManager::SerializeUserComponents(Archive& archive)
     }
 }
 
+void EntityManager::SerializeTemplates(Archive& archive)
+{
+    static thread_local ea::vector<entt::entity> entitiesBuffer;
+    auto& entities = entitiesBuffer;
+
+    if (archive.IsInput())
+    {
+        const auto block = archive.OpenArrayBlock("templates", 0);
+        for (unsigned i = 0; i < block.GetSizeHint(); ++i)
+        {
+            const auto elementBlock = archive.OpenUnorderedBlock("instance");
+
+            unsigned entityData = 0;
+            archive.Serialize("_entity", entityData);
+            unsigned templateData = 0;
+            archive.Serialize("template", templateData);
+            StringVector removedComponents;
+            SerializeValue(archive, "removed", removedComponents);
+
+            const auto entity = static_cast<entt::entity>(entityData);
+            const auto templateEntity = static_cast<entt::entity>(templateData);
+            if (!registry_.valid(entity) || !registry_.valid(templateEntity))
+                continue;
+
+            registry_.emplace_or_replace<EntityTemplateRef>(entity, templateEntity);
+            for (const ea::string& typeName : removedComponents)
+            {
+                if (EntityComponentFactory* factory = FindComponentType(typeName))
+                    pendingTemplateRemovals_.emplace_back(entity, factory);
+            }
+        }
+
+        InheritTemplateComponents();
+    }
+    else
+    {
+        EnsureComponentTypesSorted();
+
+        entities.clear();
+        for (const auto& [entity, templateRef] : registry_.storage<EntityTemplateRef>().each())
+        {
+            if (IsEntityValid(templateRef.template_))
+                entities.push_back(entity);
+        }
+        ea::sort(entities.begin(), entities.end(), EntityIndexComparator{});
+
+        const auto block = archive.OpenArrayBlock("templates", entities.size());
+        for (const entt::entity entity : entities)
+        {
+            const auto elementBlock = archive.OpenUnorderedBlock("instance");
+
+            const entt::entity templateEntity = registry_.get<EntityTemplateRef>(entity).template_;
+            auto entityData = static_cast<unsigned>(entity);
+            archive.Serialize("_entity", entityData);
+            auto templateData = static_cast<unsigned>(templateEntity);
+            archive.Serialize("template", templateData);
+
+            // Components removed from the instance should not be restored from the template.
+            StringVector removedComponents;
+            for (const auto& factory : componentFactories_)
+            {
+                if (factory->HasComponent(registry_, templateEntity) && !factory->HasComponent(registry_, entity))
+                    removedComponents.push_back(factory->GetName());
+            }
+            SerializeValue(archive, "removed", removedComponents);
+        }
+    }
+}
+
+void EntityManager::InheritTemplateComponents()
+{
+    URHO3D_PROFILE("EntityManager::InheritTemplateComponents");
+
+    struct TemplateInstance
+    {
+        /// Number of templates above the instance. Templates are resolved before their instances.
+        unsigned depth_{};
+        entt::entity template_{};
+        entt::entity entity_{};
+    };
+
+    static thread_local ea::vector<TemplateInstance> instancesBuffer;
+    auto& instances = instancesBuffer;
+    static thread_local ea::vector<entt::entity> missingBuffer;
+    auto& missing = missingBuffer;
+
+    const auto& templateRefs = registry_.storage<EntityTemplateRef>();
+    const auto maxDepth = static_cast<unsigned>(templateRefs.size());
+
+    instances.clear();
+    for (const auto& [entity, templateRef] : templateRefs.each())
+        instances.push_back(TemplateInstance{0, templateRef.template_, entity});
+
+    // Walk template chains to find depths. Loaded data may contain cycles, they are broken with an error.
+    for (TemplateInstance& instance : instances)
+    {
+        while (true)
+        {
+            instance.depth_ = 0;
+            entt::entity parentEntity = instance.entity_;
+            while (instance.depth_ <= maxDepth)
+            {
+                const auto templateRef = registry_.try_get<EntityTemplateRef>(parentEntity);
+                if (!templateRef || !registry_.valid(templateRef->template_))
+                    break;
+                parentEntity = templateRef->template_;
+                ++instance.depth_;
+            }
+
+            if (instance.depth_ <= maxDepth)
+                break;
+
+            // The chain is longer than the number of templates, so the last visited entity is in the cycle.
+            URHO3D_LOGERROR("Template of entity {} is cyclic and is ignored", parentEntity);
+            registry_.remove<EntityTemplateRef>(parentEntity);
+        }
+        instance.template_ = GetEntityTemplate(instance.entity_);
+    }
+
+    instances.erase(ea::remove_if(instances.begin(), instances.end(),
+                        [this](const TemplateInstance& instance) { return !IsEntityValid(instance.template_); }),
+        instances.end());
+    ea::sort(instances.begin(), instances.end(),
+        [](const TemplateInstance& lhs, const TemplateInstance& rhs)
+    {
+        if (lhs.depth_ != rhs.depth_)
+            return lhs.depth_ < rhs.depth_;
+        return EntityIndexComparator{}(lhs.template_, rhs.template_);
+    });
+
+    // Removals are applied right after inheritance so that nested instances don't inherit removed components.
+    ea::sort(pendingTemplateRemovals_.begin(), pendingTemplateRemovals_.end(),
+        [](const auto& lhs, const auto& rhs) { return EntityIndexComparator{}(lhs.first, rhs.first); });
+    const auto applyRemovals = [&](entt::entity entity)
+    {
+        const auto isBefore = [](const auto& removal, entt::entity entity)
+        { return EntityIndexComparator{}(removal.first, entity); };
+        for (auto iter = ea::lower_bound(
+                 pendingTemplateRemovals_.begin(), pendingTemplateRemovals_.end(), entity, isBefore);
+             iter != pendingTemplateRemovals_.end() && iter->first == entity; ++iter)
+        {
+            if (iter->second->HasComponent(registry_, entity))
+                iter->second->DestroyComponent(registry_, entity);
+        }
+    };
+
+    // Group instances by template so that each template component is copied in bulk.
+    for (auto groupBegin = instances.begin(); groupBegin != instances.end();)
+    {
+        const entt::entity templateEntity = groupBegin->template_;
+        const auto groupEnd = ea::find_if(groupBegin, instances.end(),
+            [&](const TemplateInstance& instance) { return instance.template_ != templateEntity; });
+
+        for (const auto& factory : componentFactories_)
+        {
+            if (!factory->HasComponent(registry_, templateEntity))
+                continue;
+
+            missing.clear();
+            for (auto iter = groupBegin; iter != groupEnd; ++iter)
+            {
+                if (!factory->HasComponent(registry_, iter->entity_))
+                    missing.push_back(iter->entity_);
+            }
+
+            if (!missing.empty())
+                factory->CloneComponent(registry_, templateEntity, missing);
+        }
+
+        for (auto iter = groupBegin; iter != groupEnd; ++iter)
+            applyRemovals(iter->entity_);
+
+        groupBegin = groupEnd;
+    }
+
+    pendingTemplateRemovals_.clear();
+    instances.clear();
+}
+
 void EntityManager::SerializeStandaloneEntity(Archive& archive, entt::registry& registry, entt::entity entity)
 {
     EnsureComponentTypesSorted();
@@ -729,6 +1652,80 @@ void EntityManager::SerializeStandaloneEntity(Archive& archive, entt::registry&
     }
 }
 
+void EntityManager::EncodeBitPackedEntity(
+    BitPackedOutputArchive& archive, entt::registry& registry, entt::entity entity)
+{
+    EnsureComponentTypesSorted();
+
+    // Presence of each component type is stored as single bit, followed by present components in the same order.
+    auto numComponentTypes = static_cast<unsigned>(componentFactories_.size());
+    archive.SerializeVLE("numComponentTypes", numComponentTypes);
+    for (const auto& factory : componentFactories_)
+    {
+        bool exists = factory->HasComponent(registry, entity);
+        SerializeValue(archive, "exists", exists);
+    }
+
+    for (const auto& factory : componentFactories_)
+    {
+        if (!factory->HasComponent(registry, entity))
+            continue;
+
+        unsigned version = factory->GetVersion();
+        archive.SerializeVLE("version", version);
+
+        // Component fields are quantized according to hints of the component type.
+        archive.SetHintScope(factory->GetName());
+        archive.BeginSizedBlock();
+        factory->SerializeComponent(archive, registry, entity, version);
+        archive.EndSizedBlock();
+    }
+}
+
+void EntityManager::DecodeBitPackedEntity(BitPackedInputArchive& archive, entt::registry& registry, entt::entity entity)
+{
+    EnsureComponentTypesSorted();
+
+    static thread_local ea::vector<bool> presenceBuffer;
+    auto& presence = presenceBuffer;
+    presence.clear();
+
+    // Bits are read one by one so that corrupted number of types cannot cause huge allocation.
+    unsigned numComponentTypes = 0;
+    archive.SerializeVLE("numComponentTypes", numComponentTypes);
+    for (unsigned i = 0; i < numComponentTypes; ++i)
+    {
+        bool exists{};
+        SerializeValue(archive, "exists", exists);
+        presence.push_back(exists);
+    }
+
+    const auto numKnownTypes = static_cast<unsigned>(componentFactories_.size());
+    for (unsigned i = 0; i < numComponentTypes; ++i)
+    {
+        EntityComponentFactory* factory = i < numKnownTypes ? componentFactories_[i].get() : nullptr;
+        if (!presence[i])
+        {
+            if (factory && factory->HasComponent(registry, entity))
+                factory->DestroyComponent(registry, entity);
+            continue;
+        }
+
+        unsigned version{};
+        archive.SerializeVLE("version", version);
+
+        archive.BeginSizedBlock();
+        if (factory && version <= factory->GetVersion())
+        {
+            archive.SetHintScope(factory->GetName());
+            if (!factory->HasComponent(registry, entity))
+                factory->CreateComponent(registry, entity);
+            factory->SerializeComponent(archive, registry, entity, version);
+        }
+        archive.EndSizedBlock();
+    }
+}
+
 unsigned EntityManager::GetEntityVersion(entt::entity entity)
 {
     return entt::to_version(entity);
@@ -739,10 +1736,108 @@ unsigned EntityManager::GetEntityIndex(entt::entity entity)
     return static_cast<unsigned>(entt::to_entity(entity));
 }
 
+void EntityManager::ParallelForChunks(unsigned numChunks, const ea::function<void(unsigned chunkIndex)>& callback)
+{
+    auto workQueue = GetSubsystem<WorkQueue>();
+    const unsigned numThreads = workQueue ? ea::min(workQueue->GetNumProcessingThreads(), numChunks) : 1;
+    if (numThreads <= 1)
+    {
+        for (unsigned chunkIndex = 0; chunkIndex < numChunks; ++chunkIndex)
+            callback(chunkIndex);
+        return;
+    }
+
+    // Chunks are claimed one by one, so threads that finish early keep taking work from slower ones.
+    auto state = ea::make_shared<ParallelForState>();
+    state->callback_ = &callback;
+    state->numChunks_ = numChunks;
+
+    for (unsigned i = 1; i < numThreads; ++i)
+        workQueue->PostTask([state](unsigned /*threadIndex*/) { state->ProcessChunks(); });
+
+    state->ProcessChunks();
+    while (state->numCompletedChunks_.load(std::memory_order_acquire) < numChunks)
+        std::this_thread::yield();
+}
+
+unsigned EntityManager::GetParallelChunkSize(unsigned numElements, unsigned elementSize) const
+{
+    auto workQueue = GetSubsystem<WorkQueue>();
+    const unsigned numThreads = workQueue ? ea::max(1u, workQueue->GetNumProcessingThreads()) : 1;
+
+    // Smallest number of elements that spans whole cache lines.
+    const unsigned alignment = cacheLineSize / GreatestCommonDivisor(cacheLineSize, ea::max(1u, elementSize));
+
+    const unsigned desiredChunkSize = numElements / (numThreads * numParallelChunksPerThread);
+    const unsigned chunkSize = ea::max(desiredChunkSize, minParallelChunkSize);
+    return (chunkSize + alignment - 1) / alignment * alignment;
+}
+
+void EntityManager::ClearTransientComponents()
+{
+    if (transientComponentTypes_.empty())
+        return;
+
+    URHO3D_PROFILE("EntityManager::ClearTransientComponents");
+
+    for (const auto& [typeId, clearStorage] : transientComponentTypes_)
+        frameStats_.numTransientComponentsCleared_ += clearStorage(registry_);
+}
+
+void EntityManager::SortNextStorageSpatially()
+{
+    if (spatialSorts_.empty())
+        return;
+
+    URHO3D_PROFILE("EntityManager::SortNextStorageSpatially");
+
+    nextSpatialSortIndex_ %= spatialSorts_.size();
+    auto& sortNextSlice = spatialSorts_[nextSpatialSortIndex_].sortNextSlice_;
+    frameStats_.numComponentsSpatiallySorted_ += sortNextSlice(registry_);
+    ++nextSpatialSortIndex_;
+}
+
+unsigned long long EntityManager::GetMortonCode(const Vector3& position, float cellSize)
+{
+    static constexpr unsigned bitsPerAxis = 21;
+    static constexpr int axisBias = 1 << (bitsPerAxis - 1);
+    static constexpr int axisMax = (1 << bitsPerAxis) - 1;
+
+    // Spread lower 21 bits of the value so that there are two zero bits between each pair of bits.
+    const auto spreadBits = [](float value)
+    {
+        // Clamp before conversion, converting huge or non-finite values to int is undefined. NaN maps to zero.
+        static constexpr float minValue = -axisBias;
+        static constexpr float maxValue = axisMax - axisBias;
+        const float clampedValue = IsNaN(value) ? 0.0f : Clamp(value, minValue, maxValue);
+        const int coordinate = FloorToInt(clampedValue) + axisBias;
+        auto bits = static_cast<unsigned long long>(coordinate);
+        bits = (bits | (bits << 32)) & 0x1f00000000ffffull;
+        bits = (bits | (bits << 16)) & 0x1f0000ff0000ffull;
+        bits = (bits | (bits << 8)) & 0x100f00f00f00f00full;
+        bits = (bits | (bits << 4)) & 0x10c30c30c30c30c3ull;
+        bits = (bits | (bits << 2)) & 0x1249249249249249ull;
+        return bits;
+    };
+
+    const Vector3 cellPosition = position / cellSize;
+    return spreadBits(cellPosition.x_) | (spreadBits(cellPosition.y_) << 1) | (spreadBits(cellPosition.z_) << 2);
+}
+
 void EntityManager::ForcedPostUpdate()
 {
+    URHO3D_PROFILE("EntityManager::ForcedPostUpdate");
+
     Synchronize();
     OnPostUpdateSynchronized(this, registry_);
+    ClearTransientComponents();
+    DestroyQueuedEntities();
+    SortNextStorageSpatially();
+
+    ++changeTick_;
+
+    lastFrameStats_ = frameStats_;
+    frameStats_ = {};
 }
 
 } // namespace Urho3D
@@ -2,14 +2,24 @@
 
 #include "_Plugin.h"
 
+#include "BitPackedArchive.h"
+
 #include <Urho3D/Core/Signal.h>
+#include <Urho3D/IO/VectorBuffer.h>
 #include <Urho3D/Scene/LogicComponent.h>
 #include <Urho3D/Scene/TrackedComponent.h>
 
 #include <entt/entt.hpp>
 
+#include <EASTL/functional.h>
+#include <EASTL/span.h>
 #include <EASTL/unique_ptr.h>
 
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <tuple>
+
 // Support formatting for entt::entity.
 template <> struct fmt::formatter<entt::entity>
 {
@@ -29,17 +39,26 @@ template <> struct fmt::formatter<entt::entity>
 namespace Urho3D
 {
 
+class EntityBitset;
+class EntityComponentFactory;
 class EntityReference;
+class EntityValueIndexBase;
+template <class T, class Key> class EntityHashIndex;
+template <class T, class Key> class EntityOrderedIndex;
+template <class T> class EntitySpatialIndex;
 
 /// Component that is used to tag currently materialized entities.
 /// EntityReference is expected to be valid.
+/// Tag is removed when EntityReference leaves the scene or EntityManager is removed from the scene,
+/// so the pointer never dangles.
 struct EntityMaterialized
 {
-    WeakPtr<EntityReference> entityReference_;
+    EntityReference* entityReference_{};
 };
 
 /// Component that is used to tag entities with updated transforms.
-/// It is up to the user to clear this component when it's not needed anymore.
+/// It is up to the user to clear this component when it's not needed anymore,
+/// or to mark it as transient via EntityManager::AddTransientComponentType.
 struct EntityTransformDirty
 {
     static constexpr unsigned Version = 1;
@@ -47,6 +66,95 @@ struct EntityTransformDirty
     bool RenderInspector() { return false; }
 };
 
+/// Component that links template instance to its template entity.
+/// Instance components equal to template components are not serialized and are restored from the template on load.
+struct EntityTemplateRef
+{
+    entt::entity template_{entt::null};
+};
+
+/// Component that stores change ticks of component T in the same entity.
+/// It exists only for component types registered via EntityManager::TrackComponentChanges.
+template <class T> struct EntityComponentTicks
+{
+    unsigned added_{};
+    unsigned changed_{};
+};
+
+/// Per-frame counters of EntityManager.
+struct EntityManagerStats
+{
+    unsigned numEntitiesMaterialized_{};
+    unsigned numEntitiesDematerialized_{};
+    unsigned numEntitiesDestroyed_{};
+    unsigned numDecodesQueued_{};
+    unsigned numDecodesProcessed_{};
+    unsigned numBytesEncoded_{};
+    unsigned numBytesDecoded_{};
+    unsigned numTransientComponentsCleared_{};
+    unsigned numComponentsSpatiallySorted_{};
+    long long synchronizeTimeUs_{};
+};
+
+/// Reactive query that collects entities whose trigger component was added and/or updated
+/// while entity had all required components.
+/// Entities are stored in dense list without duplicates until the query is consumed.
+class PLUGIN_CORE_ENTITYMANAGER_API EntityReactiveQuery
+{
+public:
+    EntityReactiveQuery(EntityComponentFactory* triggerType, bool onAdded, bool onUpdated,
+        const ea::vector<EntityComponentFactory*>& requiredTypes);
+
+    /// Iterate collected entities that are still valid and have all components, then clear the query.
+    template <class Callback> void Consume(entt::registry& registry, const Callback& callback);
+    /// Return collected entities as is.
+    ea::span<const entt::entity> GetEntities() const;
+    void Clear() { entities_.clear(); }
+
+    EntityComponentFactory* GetTriggerType() const { return triggerType_; }
+    bool IsTriggeredOnAdded() const { return onAdded_; }
+    bool IsTriggeredOnUpdated() const { return onUpdated_; }
+    bool IsMatching(entt::registry& registry, entt::entity entity) const;
+    /// Collect entities whose trigger component was removed instead of dropping them.
+    /// Such entities never pass Consume, use GetEntities instead.
+    void SetCollectRemoved(bool collectRemoved) { collectRemoved_ = collectRemoved; }
+    bool IsCollectingRemoved() const { return collectRemoved_; }
+
+    /// Component signal listeners.
+    /// @{
+    void OnTriggered(entt::registry& registry, entt::entity entity);
+    void OnTriggerRemoved(entt::registry& registry, entt::entity entity);
+    /// @}
+
+private:
+    EntityComponentFactory* triggerType_{};
+    bool onAdded_{};
+    bool onUpdated_{};
+    bool collectRemoved_{};
+    ea::vector<EntityComponentFactory*> requiredTypes_;
+
+    entt::sparse_set entities_;
+    ea::vector<entt::entity> consumedEntities_;
+};
+
+/// Mapping from entities of the source registry to entities of the destination registry.
+/// Components that store entities may implement `void RemapEntities(const EntityRemap& remap)`
+/// to fix references when registries are merged.
+class PLUGIN_CORE_ENTITYMANAGER_API EntityRemap
+{
+public:
+    void Clear() { entities_.clear(); }
+    void Add(entt::entity sourceEntity, entt::entity entity);
+
+    /// Return remapped entity. Null and unknown entities are remapped to null.
+    entt::entity Remap(entt::entity sourceEntity) const;
+    void RemapInPlace(entt::entity& entity) const { entity = Remap(entity); }
+
+private:
+    /// Pairs of source and destination entities indexed by source entity index.
+    ea::vector<ea::pair<entt::entity, entt::entity>> entities_;
+};
+
 /// Interface to manage EnTT components.
 class PLUGIN_CORE_ENTITYMANAGER_API EntityComponentFactory
 {
@@ -54,6 +162,8 @@ public:
     EntityComponentFactory(const ea::string& name);
     const ea::string& GetName() const { return name_; }
 
+    /// Called once when the factory is added to EntityManager. Does nothing by default.
+    virtual void Initialize(entt::registry& registry) {}
     virtual bool IsEmpty() const = 0;
     virtual unsigned GetVersion() const = 0;
     virtual bool HasComponent(entt::registry& registry, entt::entity entity) = 0;
@@ -62,8 +172,22 @@ public:
     virtual void SerializeComponent(
         Archive& archive, entt::registry& registry, entt::entity entity, unsigned version) = 0;
     virtual void SerializeComponents(Archive& archive, entt::registry& registry, unsigned version) = 0;
+    /// Called after SerializeRegistry has loaded all components and inherited template components.
+    /// Does nothing by default.
+    virtual void OnRegistryLoaded(entt::registry& registry) {}
     virtual bool RenderUI(entt::registry& registry, entt::entity entity) = 0;
     virtual void CommitActions(entt::registry& registry) = 0;
+    /// Connect reactive query to component signals. Return false if reactive queries are not supported.
+    virtual bool ConnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query);
+    virtual void DisconnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query) {}
+    /// Return whether SerializeSnapshot is implemented. Unsupported factories are skipped by snapshots.
+    virtual bool IsSnapshotSupported() const { return false; }
+    /// Save or restore all components in same-process snapshot format. Does nothing by default.
+    virtual void SerializeSnapshot(Archive& archive, entt::registry& registry) {}
+    /// Copy all components from another registry. Not supported by default.
+    virtual void MergeComponents(entt::registry& registry, entt::registry& sourceRegistry, const EntityRemap& remap);
+    /// Copy component of the entity to clones. Not supported by default.
+    virtual void CloneComponent(entt::registry& registry, entt::entity entity, ea::span<const entt::entity> clones);
 
 private:
     ea::string name_;
@@ -81,6 +205,7 @@ public:
     Signal<void(entt::registry& registry)> OnPostUpdateSynchronized;
 
     EntityManager(Context* context);
+    ~EntityManager() override;
     static void RegisterObject(Context* context);
 
     void ApplyAttributes() override;
@@ -101,7 +226,26 @@ public:
     /// It should be done as soon as possible, preferably in the constructor of derived class.
     void AddComponentType(ea::unique_ptr<EntityComponentFactory> factory);
     template <class T> void AddComponentType(const ea::string& name);
+    /// Register SharedEntityComponent<T> with deduplicated values. Defined in SharedEntityComponent.h.
+    template <class T> void AddSharedComponentType(const ea::string& name);
+    /// Register empty tag component T serialized as ranges of entity indices. Defined in TagEntityComponent.h.
+    template <class T> void AddTagComponentType(const ea::string& name);
+    /// Register logical component split into Hot and Cold parts stored separately.
+    /// Defined in HotColdEntityComponent.h.
+    template <class Hot, class Cold> void AddHotColdComponentType(const ea::string& name);
+    /// Register float-only component T stored as structure of arrays. Defined in SoAEntityComponent.h.
+    template <class T> void AddSoAComponentType(const ea::string& name);
+    /// Mark component T as transient. Transient components are removed from all entities
+    /// at the end of ForcedPostUpdate, after OnPostUpdateSynchronized is sent.
+    /// Storage memory is retained between frames. T may or may not be registered as regular component type.
+    template <class T> void AddTransientComponentType();
+    /// Register component T that can be disabled without removal.
+    /// Disabled state is stored in per-type bitset and is exposed as empty component "<name>Disabled".
+    /// Defined in TagEntityComponent.h.
+    template <class T> void AddToggleableComponentType(const ea::string& name);
     EntityComponentFactory* FindComponentType(ea::string_view name) const;
+    /// Return all registered component types sorted by name.
+    const ea::vector<ea::unique_ptr<EntityComponentFactory>>& GetComponentTypes();
 
     bool IsEntityValid(entt::entity entity) const;
     EntityReference* EntityToReference(entt::entity entity) const;
@@ -114,21 +258,161 @@ public:
     bool IsEntityMaterialized(entt::entity entity) const;
     EntityReference* MaterializeEntity(entt::entity entity);
     void DematerializeEntity(entt::entity entity);
+    /// Deferred destruction. Queued entities are destroyed in one batch at the end of ForcedPostUpdate.
+    /// Destruction is cancelled if the entity is materialized or connected to a node again before that.
+    /// Saved registry keeps queued entities as pending. It is safe to queue entities during iteration.
+    /// @{
+    void QueueDestroyEntity(entt::entity entity);
+    void DestroyQueuedEntities();
+    /// @}
+
+    /// Allocation-free enumeration of entities.
+    /// Returned spans point directly into registry storages and are invalidated by any structural change.
+    /// @{
+    ea::span<const entt::entity> GetEntities() const;
+    ea::span<const entt::entity> GetMaterializedEntities() const;
+    static ea::span<const entt::entity> GetEntitiesChunk(
+        ea::span<const entt::entity> entities, unsigned chunkIndex, unsigned chunkSize);
+    static unsigned GetNumEntitiesChunks(ea::span<const entt::entity> entities, unsigned chunkSize);
+    /// @}
+
+    /// Parallel iteration over entities that have all specified components.
+    /// Leading component storage is split into cache-aligned chunks processed by worker threads.
+    /// Callback receives entity and references to non-empty components and must not change registry structure.
+    /// If checks are enabled, construction and destruction of iterated components are counted via signals,
+    /// so any structural change of iterated storages is reported, including removal followed by addition.
+    /// @{
+    template <class... Components, class Callback> void ParallelEach(const Callback& callback);
+    void SetParallelIterationChecks(bool enabled) { parallelIterationChecks_ = enabled; }
+    bool GetParallelIterationChecks() const { return parallelIterationChecks_; }
+    /// @}
+
+    /// Iterate storage of T in contiguous chunks that match storage pages.
+    /// Callback receives spans of entities and components. Component spans start at aligned address
+    /// if storage of T is declared via URHO3D_ENTITY_ALIGNED_STORAGE. Defined in EntityAlignedStorage.h.
+    template <class T, class Callback> void ForEachComponentChunk(const Callback& callback);
+
+    /// Enable or disable components without structural changes in registry, only a bit is flipped.
+    /// Disabled components still exist and are visible in regular views. Defined in TagEntityComponent.h.
+    /// @{
+    template <class T> void SetComponentEnabled(entt::entity entity, bool enabled);
+    template <class T> bool IsComponentEnabled(entt::entity entity) const;
+    /// Iterate view of components and skip entities with any of the components disabled.
+    /// Callback receives entity and non-empty components, same as entt::view::each.
+    template <class... Components, class Callback> void ForEachEnabled(const Callback& callback);
+    /// @}
+
+    /// Register EnTT group for hot combination of components. Should be done after component types are added.
+    /// Owned storages are kept packed and ordered by the group, they cannot be owned by another group
+    /// or sorted spatially.
+    /// Group is retrieved via GetGroup with the same arguments and is valid until the manager is destroyed.
+    /// @{
+    template <class... Owned, class... Get, class... Exclude>
+    bool AddGroup(
+        const ea::string& name, entt::get_t<Get...> = entt::get_t{}, entt::exclude_t<Exclude...> = entt::exclude_t{});
+    template <class... Owned, class... Get, class... Exclude>
+    auto GetGroup(entt::get_t<Get...> = entt::get_t{}, entt::exclude_t<Exclude...> = entt::exclude_t{});
+    template <class T> bool IsComponentTypeOwned() const;
+    /// @}
+
+    /// Opt-in spatially coherent order of component storages.
+    /// Storage of T is sorted by Morton code of position projected from component, storages of Dependents
+    /// are sorted to match it. Registered storages are processed one per frame at the end of ForcedPostUpdate.
+    /// Each frame sorts only a slice of up to sliceSize components. Slices overlap by half and sweep the storage,
+    /// so the order converges over several passes and per-frame cost doesn't depend on storage size.
+    /// Dependents are matched to T once per full pass. Storages owned by groups cannot be sorted.
+    /// @{
+    template <class T, class... Dependents>
+    void AddSpatialSort(
+        const ea::function<Vector3(const T& component)>& projection, float cellSize, unsigned sliceSize = 4096);
+    void SortNextStorageSpatially();
+    static unsigned long long GetMortonCode(const Vector3& position, float cellSize);
+    /// @}
+
+    /// Secondary indexes of entities by value projected from component. Indexes are owned by EntityManager.
+    /// Defined in EntityValueIndex.h.
+    /// @{
+    template <class T, class Key>
+    EntityHashIndex<T, Key>* AddHashIndex(const ea::function<Key(const T& component)>& projection);
+    template <class T, class Key>
+    EntityOrderedIndex<T, Key>* AddOrderedIndex(const ea::function<Key(const T& component)>& projection);
+    /// Spatial index over position projected from component. Defined in EntitySpatialIndex.h.
+    template <class T>
+    EntitySpatialIndex<T>* AddSpatialIndex(const ea::function<Vector3(const T& component)>& projection, float cellSize);
+    void RemoveValueIndex(EntityValueIndexBase* index);
+    /// @}
+
+    /// Reactive queries over registered component types. Queries are owned by EntityManager.
+    /// @{
+    EntityReactiveQuery* CreateReactiveQuery(ea::string_view triggerType, bool onAdded, bool onUpdated,
+        const StringVector& requiredTypes = {});
+    void RemoveReactiveQuery(EntityReactiveQuery* query);
+    /// @}
+
+    /// Change detection for components registered via TrackComponentChanges.
+    /// Change tick is advanced after each post-update. Component is "changed since tick N"
+    /// if it was added, patched or replaced during tick N or later.
+    /// @{
+    template <class T> void TrackComponentChanges();
+    unsigned GetChangeTick() const { return changeTick_; }
+    template <class T> bool IsComponentAddedSince(entt::entity entity, unsigned tick) const;
+    template <class T> bool IsComponentChangedSince(entt::entity entity, unsigned tick) const;
+    template <class T, class Callback> void EachComponentAddedSince(unsigned tick, const Callback& callback);
+    template <class T, class Callback> void EachComponentChangedSince(unsigned tick, const Callback& callback);
+    /// @}
+
+    /// Rollback snapshots stored in ring buffer and identified by user-provided tick.
+    /// Restoring snapshot keeps nodes of entities that stay materialized.
+    /// Snapshots are discarded when new component type is registered.
+    /// @{
+    void SetMaxSnapshots(unsigned maxSnapshots);
+    unsigned GetMaxSnapshots() const { return snapshots_.size(); }
+    void SaveSnapshot(unsigned tick);
+    bool RestoreSnapshot(unsigned tick);
+    bool HasSnapshot(unsigned tick) const;
+    /// @}
+
+    /// Copy all entities and registered components from another registry.
+    /// New entities are allocated for all source entities and materialized on the next synchronization
+    /// unless source registry marks them as dematerialized.
+    /// Return mapping from source entities to new entities.
+    EntityRemap MergeRegistry(entt::registry& sourceRegistry);
+    /// Create copies of the entity with all registered components.
+    /// Clones are materialized if the entity is materialized. Node components are not copied.
+    ea::vector<entt::entity> CloneEntity(entt::entity entity, unsigned count = 1);
+
+    /// Prefab templates. Any entity can be a template, usually dematerialized.
+    /// Instances share serialized data with the template and store only overridden components.
+    /// @{
+    /// Create materialized instances of the template with all registered components copied.
+    ea::vector<entt::entity> InstantiateTemplate(entt::entity templateEntity, unsigned count = 1);
+    /// Set or reset (if null) template of existing entity. Templates may be nested but not cyclic.
+    void SetEntityTemplate(entt::entity entity, entt::entity templateEntity);
+    entt::entity GetEntityTemplate(entt::entity entity) const;
+    /// @}
 
     /// Per-entity serialization. Use with caution.
     /// @{
+    /// Decoding returns whether the data was decoded successfully.
     ByteVector EncodeEntity(entt::registry& registry, entt::entity entity);
-    void DecodeEntity(entt::registry& registry, entt::entity entity, const ByteVector& data);
+    bool DecodeEntity(entt::registry& registry, entt::entity entity, const ByteVector& data);
+    /// Bit-packed encoding for network. Hints are scoped by component type name.
+    /// Component types are identified by index in the list sorted by name,
+    /// so both sides are expected to register the same types.
+    /// Components of unknown types or newer versions are skipped on decode.
+    ByteVector EncodeEntity(entt::registry& registry, entt::entity entity, const QuantizationHints& hints);
+    bool DecodeEntity(entt::registry& registry, entt::entity entity, const ByteVector& data, const QuantizationHints& hints);
 
-    ea::vector<entt::entity> GetEntities() const;
     ByteVector EncodeEntity(entt::entity entity);
-    void DecodeEntity(entt::entity entity, const ByteVector& data);
+    bool DecodeEntity(entt::entity entity, const ByteVector& data);
     void QueueDecodeEntity(EntityReference* entityReference, const ByteVector& data);
     /// @}
 
     /// Getters.
     /// @{
     entt::registry& Registry() { return registry_; }
+    /// Return counters of the last completed frame.
+    const EntityManagerStats& GetFrameStats() const { return lastFrameStats_; }
     /// @}
 
     /// Attributes.
@@ -143,8 +427,26 @@ public:
     /// @{
     static unsigned GetEntityVersion(entt::entity entity);
     static unsigned GetEntityIndex(entt::entity entity);
+    /// Process chunks on worker threads. Idle threads pick up remaining chunks. Blocks until all chunks are done.
+    void ParallelForChunks(unsigned numChunks, const ea::function<void(unsigned chunkIndex)>& callback);
+    /// Return chunk size for parallel iteration so that chunks start at cache line boundaries.
+    unsigned GetParallelChunkSize(unsigned numElements, unsigned elementSize) const;
     template <class T>
     static void SerializeComponents(Archive& archive, const char* name, entt::registry& registry, unsigned version);
+    /// Return whether the component of template instance is equal to template component and can be skipped on save.
+    template <class T> static bool IsComponentInherited(entt::registry& registry, entt::entity entity);
+    /// Return valid template of the entity or null.
+    static entt::entity FindValidTemplate(const entt::registry& registry, entt::entity entity);
+    /// Fill entities to save from the range: components inherited from templates are skipped,
+    /// remaining entities are sorted by index. The predicate is called only if there are template instances.
+    template <class Range, class Predicate>
+    static void CollectSerializedEntities(ea::vector<entt::entity>& entities, entt::registry& registry,
+        const Range& range, const Predicate& isInherited);
+    /// Save or restore storage in same-process snapshot format.
+    /// Trivially copyable components are copied as raw memory and replaced only if changed.
+    /// Return whether any component was added, removed or replaced on restore.
+    /// Components that are not trivially copyable are replaced only if changed when they support operator==.
+    template <class T> static bool SerializeComponentsSnapshot(Archive& archive, entt::registry& registry);
     /// @}
 
 protected:
@@ -175,11 +477,30 @@ private:
 
     void EnsureComponentTypesSorted();
     void EnsureEntitiesMaterialized();
+    void ClearTransientComponents();
+
+    /// Connect or disconnect counting of structural changes in storage of T.
+    template <class T> void ConnectIterationChecks(bool connect);
+    void OnIterationStructureChanged(entt::registry& registry, entt::entity entity) { ++numIterationStructureChanges_; }
+    template <class T> void OnTrackedComponentAdded(entt::registry& registry, entt::entity entity);
+    template <class T> void OnTrackedComponentUpdated(entt::registry& registry, entt::entity entity);
+    template <class T> void OnTrackedComponentRemoved(entt::registry& registry, entt::entity entity);
+    /// Return disabled state of toggleable component T or null if no components are disabled.
+    template <class T> static const EntityBitset* GetDisabledBitset(const entt::registry& registry);
 
     void SerializeRegistry(Archive& archive);
-    void SerializeEntities(Archive& archive);
+    /// Serialize registry format version. Return version of loaded data.
+    /// Binary data saved without version starts with number of entities, which is returned via legacyNumEntities.
+    unsigned SerializeRegistryVersion(Archive& archive, unsigned& legacyNumEntities);
+    void SerializeEntities(Archive& archive, unsigned legacyNumEntities);
     void SerializeUserComponents(Archive& archive);
+    void SerializeTemplates(Archive& archive);
+    void InheritTemplateComponents();
     void SerializeStandaloneEntity(Archive& archive, entt::registry& registry, entt::entity entity);
+    void EncodeBitPackedEntity(BitPackedOutputArchive& archive, entt::registry& registry, entt::entity entity);
+    void DecodeBitPackedEntity(BitPackedInputArchive& archive, entt::registry& registry, entt::entity entity);
+    void SerializeSnapshot(Archive& archive);
+    bool SerializeSnapshotEntities(Archive& archive);
 
     void RenderEntityHeader(entt::entity entity);
     EntityComponentFactory* RenderCreateComponent(entt::entity entity);
@@ -194,8 +515,55 @@ private:
     bool registryDirty_{};
     ea::unordered_set<WeakPtr<EntityReference>> pendingEntitiesAdded_;
     ea::vector<ea::pair<WeakPtr<EntityReference>, ByteVector>> pendingEntityDecodes_;
+    ea::vector<entt::entity> pendingEntityDestroys_;
+    ea::vector<entt::entity> destroyedEntitiesBuffer_;
+    ea::vector<ea::pair<entt::entity, EntityComponentFactory*>> pendingTemplateRemovals_;
     bool synchronizationInProgress_{};
     bool suppressComponentEvents_{};
+    bool parallelIterationChecks_{};
+    /// Number of structural changes of storages iterated by ParallelEach with enabled checks.
+    std::atomic<unsigned> numIterationStructureChanges_{};
+
+    ea::vector<ea::unique_ptr<EntityReactiveQuery>> reactiveQueries_;
+    ea::vector<ea::unique_ptr<EntityValueIndexBase>> valueIndices_;
+
+    struct GroupDesc
+    {
+        ea::string name_;
+        entt::id_type id_{};
+        ea::vector<entt::id_type> ownedTypes_;
+        unsigned (*getSize_)(entt::registry& registry){};
+    };
+    ea::vector<GroupDesc> groups_;
+
+    struct SpatialSortDesc
+    {
+        /// Types of sorted storage and its dependents.
+        ea::vector<entt::id_type> sortedTypes_;
+        /// Sort next slice of storages. Return number of processed components.
+        ea::function<unsigned(entt::registry& registry)> sortNextSlice_;
+    };
+    ea::vector<SpatialSortDesc> spatialSorts_;
+    unsigned nextSpatialSortIndex_{};
+
+    struct Snapshot
+    {
+        unsigned tick_{};
+        bool valid_{};
+        ea::unique_ptr<VectorBuffer> data_;
+    };
+    ea::vector<Snapshot> snapshots_;
+    unsigned nextSnapshotIndex_{};
+    entt::sparse_set snapshotEntitiesSet_;
+
+    EntityManagerStats frameStats_;
+    EntityManagerStats lastFrameStats_;
+
+    unsigned changeTick_{1};
+    ea::vector<entt::id_type> trackedComponentTypes_;
+
+    /// Transient component types and functions that clear their storages.
+    ea::vector<ea::pair<entt::id_type, unsigned (*)(entt::registry& registry)>> transientComponentTypes_;
 
     struct EditorUI
     {
@@ -206,6 +574,28 @@ private:
     } ui_;
 };
 
+/// Whether the component implements RemapEntities.
+template <class T, class = void> struct IsEntityRemappable : std::false_type
+{
+};
+
+template <class T>
+struct IsEntityRemappable<T, std::void_t<decltype(std::declval<T&>().RemapEntities(std::declval<const EntityRemap&>()))>>
+    : std::true_type
+{
+};
+
+/// Whether the component supports equality comparison.
+template <class T, class = void> struct IsEntityComponentComparable : std::false_type
+{
+};
+
+template <class T>
+struct IsEntityComponentComparable<T, std::void_t<decltype(std::declval<const T&>() == std::declval<const T&>())>>
+    : std::true_type
+{
+};
+
 /// Default implementation of EntityComponentFactory.
 /// T is expected to have certain functions and static members.
 template <class T> class DefaultEntityComponentFactory : public EntityComponentFactory
@@ -215,6 +605,7 @@ public:
 
     /// Implement EntityComponentFactory.
     /// @{
+    void Initialize(entt::registry& registry) override {}
     bool IsEmpty() const override { return std::is_empty_v<T>; }
     unsigned GetVersion() const override { return T::Version; }
 
@@ -225,6 +616,12 @@ public:
     void SerializeComponents(Archive& archive, entt::registry& registry, unsigned version) override;
     bool RenderUI(entt::registry& registry, entt::entity entity) override;
     void CommitActions(entt::registry& registry) override;
+    bool ConnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query) override;
+    void DisconnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query) override;
+    bool IsSnapshotSupported() const override { return true; }
+    void SerializeSnapshot(Archive& archive, entt::registry& registry) override;
+    void MergeComponents(entt::registry& registry, entt::registry& sourceRegistry, const EntityRemap& remap) override;
+    void CloneComponent(entt::registry& registry, entt::entity entity, ea::span<const entt::entity> clones) override;
     /// @}
 
 private:
@@ -243,20 +640,312 @@ private:
 namespace Urho3D
 {
 
+template <class Callback> void EntityReactiveQuery::Consume(entt::registry& registry, const Callback& callback)
+{
+    // Entities triggered by the callback itself are collected for the next consumption.
+    consumedEntities_.assign(entities_.begin(), entities_.end());
+    entities_.clear();
+
+    for (const entt::entity entity : consumedEntities_)
+    {
+        if (registry.valid(entity) && IsMatching(registry, entity))
+            callback(entity);
+    }
+}
+
 template <class T> void EntityManager::AddComponentType(const ea::string& name)
 {
     AddComponentType(ea::make_unique<DefaultEntityComponentFactory<T>>(name));
 }
 
+template <class... Components, class Callback> void EntityManager::ParallelEach(const Callback& callback)
+{
+    static_assert(sizeof...(Components) > 0, "At least one component type is expected");
+    using LeadingComponent = std::tuple_element_t<0, std::tuple<Components...>>;
+
+    const auto view = registry_.view<Components...>();
+    const auto& leadingStorage = registry_.storage<LeadingComponent>();
+    const ea::span<const entt::entity> entities{leadingStorage.data(), static_cast<eastl_size_t>(leadingStorage.size())};
+
+    const auto numEntities = static_cast<unsigned>(entities.size());
+    const unsigned chunkSize = GetParallelChunkSize(numEntities, sizeof(LeadingComponent));
+    const unsigned numChunks = GetNumEntitiesChunks(entities, chunkSize);
+
+    const bool checksEnabled = parallelIterationChecks_;
+    if (checksEnabled)
+    {
+        numIterationStructureChanges_ = 0;
+        (ConnectIterationChecks<Components>(true), ...);
+    }
+
+    ParallelForChunks(numChunks,
+        [&](unsigned chunkIndex)
+    {
+        for (const entt::entity entity : GetEntitiesChunk(entities, chunkIndex, chunkSize))
+        {
+            if (view.contains(entity))
+                std::apply(callback, std::tuple_cat(std::make_tuple(entity), view.get(entity)));
+        }
+    });
+
+    if (!checksEnabled)
+        return;
+
+    (ConnectIterationChecks<Components>(false), ...);
+    if (numIterationStructureChanges_ != 0)
+    {
+        URHO3D_LOGERROR("Registry structure was changed during EntityManager::ParallelEach");
+        URHO3D_ASSERT(false);
+    }
+}
+
+template <class T> void EntityManager::ConnectIterationChecks(bool connect)
+{
+    if (connect)
+    {
+        registry_.on_construct<T>().template connect<&EntityManager::OnIterationStructureChanged>(*this);
+        registry_.on_destroy<T>().template connect<&EntityManager::OnIterationStructureChanged>(*this);
+    }
+    else
+    {
+        registry_.on_construct<T>().template disconnect<&EntityManager::OnIterationStructureChanged>(*this);
+        registry_.on_destroy<T>().template disconnect<&EntityManager::OnIterationStructureChanged>(*this);
+    }
+}
+
+template <class T> void EntityManager::AddTransientComponentType()
+{
+    const entt::id_type typeId = entt::type_hash<T>::value();
+    const auto isSameType = [typeId](const auto& transientType) { return transientType.first == typeId; };
+    if (ea::any_of(transientComponentTypes_.begin(), transientComponentTypes_.end(), isSameType))
+        return;
+
+    const auto clearStorage = [](entt::registry& registry)
+    {
+        auto& storage = registry.storage<T>();
+        const auto numComponents = static_cast<unsigned>(storage.size());
+        if (numComponents != 0)
+            registry.clear<T>();
+        return numComponents;
+    };
+    transientComponentTypes_.emplace_back(typeId, +clearStorage);
+}
+
+template <class... Owned, class... Get, class... Exclude>
+bool EntityManager::AddGroup(const ea::string& name, entt::get_t<Get...>, entt::exclude_t<Exclude...>)
+{
+    using GroupSignature = entt::type_list<entt::owned_t<Owned...>, entt::get_t<Get...>, entt::exclude_t<Exclude...>>;
+    const entt::id_type groupId = entt::type_hash<GroupSignature>::value();
+    const auto isSameGroup = [groupId](const GroupDesc& group) { return group.id_ == groupId; };
+    if (ea::any_of(groups_.begin(), groups_.end(), isSameGroup))
+        return true;
+
+    const ea::vector<entt::id_type> ownedTypes{entt::type_hash<Owned>::value()...};
+    for (const SpatialSortDesc& spatialSort : spatialSorts_)
+    {
+        for (const entt::id_type typeId : ownedTypes)
+        {
+            const auto& sortedTypes = spatialSort.sortedTypes_;
+            if (ea::find(sortedTypes.begin(), sortedTypes.end(), typeId) != sortedTypes.end())
+            {
+                URHO3D_LOGERROR("Cannot add group '{}': component storage is sorted spatially", name);
+                return false;
+            }
+        }
+    }
+
+    for (const GroupDesc& group : groups_)
+    {
+        for (const entt::id_type typeId : ownedTypes)
+        {
+            if (ea::find(group.ownedTypes_.begin(), group.ownedTypes_.end(), typeId) != group.ownedTypes_.end())
+            {
+                URHO3D_LOGERROR("Cannot add group '{}': component is already owned by group '{}'", name, group.name_);
+                return false;
+            }
+        }
+    }
+
+    // Group is populated from existing components and maintained via storage signals afterwards.
+    GetGroup<Owned...>(entt::get<Get...>, entt::exclude<Exclude...>);
+
+    const auto getSize = [](entt::registry& registry)
+    { return static_cast<unsigned>(registry.group<Owned...>(entt::get<Get...>, entt::exclude<Exclude...>).size()); };
+    groups_.push_back(GroupDesc{name, groupId, ownedTypes, +getSize});
+    return true;
+}
+
+template <class... Owned, class... Get, class... Exclude>
+auto EntityManager::GetGroup(entt::get_t<Get...>, entt::exclude_t<Exclude...>)
+{
+    return registry_.group<Owned...>(entt::get<Get...>, entt::exclude<Exclude...>);
+}
+
+template <class T> bool EntityManager::IsComponentTypeOwned() const
+{
+    const entt::id_type typeId = entt::type_hash<T>::value();
+    return ea::any_of(groups_.begin(), groups_.end(), [typeId](const GroupDesc& group)
+        { return ea::find(group.ownedTypes_.begin(), group.ownedTypes_.end(), typeId) != group.ownedTypes_.end(); });
+}
+
+template <class T, class... Dependents>
+void EntityManager::AddSpatialSort(
+    const ea::function<Vector3(const T& component)>& projection, float cellSize, unsigned sliceSize)
+{
+    static_assert(!std::is_empty_v<T>, "Empty components cannot be sorted spatially");
+    static_assert(!entt::component_traits<T>::in_place_delete, "Storage with tombstones cannot be sorted by slices");
+
+    if (cellSize <= 0.0f || sliceSize < 2)
+    {
+        URHO3D_LOGERROR("Spatial sort cell size should be positive and slice should contain at least 2 components");
+        return;
+    }
+
+    if (IsComponentTypeOwned<T>() || (IsComponentTypeOwned<Dependents>() || ...))
+    {
+        URHO3D_LOGERROR("Cannot spatially sort component storages owned by groups");
+        return;
+    }
+
+    ea::vector<entt::id_type> sortedTypes{entt::type_hash<T>::value(), entt::type_hash<Dependents>::value()...};
+    for (const SpatialSortDesc& spatialSort : spatialSorts_)
+    {
+        const auto& otherTypes = spatialSort.sortedTypes_;
+        const auto isSorted = [&](entt::id_type typeId)
+        { return ea::find(otherTypes.begin(), otherTypes.end(), typeId) != otherTypes.end(); };
+        if (ea::any_of(sortedTypes.begin(), sortedTypes.end(), isSorted))
+        {
+            URHO3D_LOGERROR("Component storage is already sorted spatially");
+            return;
+        }
+    }
+
+    const auto sortNextSlice = [projection, cellSize, sliceSize, offset = 0u](entt::registry& registry) mutable
+    {
+        static thread_local ea::vector<ea::pair<unsigned long long, entt::entity>> codesBuffer;
+        auto& codes = codesBuffer;
+
+        auto& storage = registry.storage<T>();
+        const auto numComponents = static_cast<unsigned>(storage.size());
+        if (offset >= numComponents)
+        {
+            // Dependents are matched once per pass because it takes linear time.
+            offset = 0;
+            (registry.sort<Dependents, T>(), ...);
+        }
+
+        const unsigned first = offset;
+        const unsigned last = ea::min(first + sliceSize, numComponents);
+        // Slices overlap so that components can travel across slice boundaries.
+        offset = last < numComponents ? first + sliceSize / 2 : numComponents;
+
+        codes.clear();
+        for (unsigned i = first; i < last; ++i)
+        {
+            const entt::entity entity = storage.data()[i];
+            codes.emplace_back(GetMortonCode(projection(storage.get(entity)), cellSize), entity);
+        }
+
+        // Entity breaks ties so that equal codes don't cause swaps every frame.
+        const auto isUnordered = [](const auto& lhs, const auto& rhs) { return rhs < lhs; };
+        if (ea::adjacent_find(codes.begin(), codes.end(), isUnordered) != codes.end())
+        {
+            ea::sort(codes.begin(), codes.end());
+            for (unsigned i = first; i < last; ++i)
+            {
+                const entt::entity entity = codes[i - first].second;
+                if (storage.data()[i] != entity)
+                    storage.swap_elements(storage.data()[i], entity);
+            }
+        }
+
+        codes.clear();
+        return last - first;
+    };
+    spatialSorts_.push_back(SpatialSortDesc{ea::move(sortedTypes), sortNextSlice});
+}
+
+template <class T> void EntityManager::TrackComponentChanges()
+{
+    const entt::id_type typeId = entt::type_hash<T>::value();
+    if (ea::find(trackedComponentTypes_.begin(), trackedComponentTypes_.end(), typeId) != trackedComponentTypes_.end())
+        return;
+    trackedComponentTypes_.push_back(typeId);
+
+    registry_.on_construct<T>().template connect<&EntityManager::OnTrackedComponentAdded<T>>(*this);
+    registry_.on_update<T>().template connect<&EntityManager::OnTrackedComponentUpdated<T>>(*this);
+    registry_.on_destroy<T>().template connect<&EntityManager::OnTrackedComponentRemoved<T>>(*this);
+
+    for (const entt::entity entity : registry_.view<T>())
+        registry_.emplace_or_replace<EntityComponentTicks<T>>(entity, changeTick_, changeTick_);
+}
+
+template <class T> bool EntityManager::IsComponentAddedSince(entt::entity entity, unsigned tick) const
+{
+    const auto ticks = registry_.try_get<EntityComponentTicks<T>>(entity);
+    return ticks && ticks->added_ >= tick;
+}
+
+template <class T> bool EntityManager::IsComponentChangedSince(entt::entity entity, unsigned tick) const
+{
+    const auto ticks = registry_.try_get<EntityComponentTicks<T>>(entity);
+    return ticks && ticks->changed_ >= tick;
+}
+
+template <class T, class Callback>
+void EntityManager::EachComponentAddedSince(unsigned tick, const Callback& callback)
+{
+    for (const auto& [entity, ticks] : registry_.storage<EntityComponentTicks<T>>().each())
+    {
+        if (ticks.added_ < tick)
+            continue;
+
+        if constexpr (!std::is_empty_v<T>)
+            callback(entity, registry_.get<T>(entity));
+        else
+            callback(entity);
+    }
+}
+
+template <class T, class Callback>
+void EntityManager::EachComponentChangedSince(unsigned tick, const Callback& callback)
+{
+    for (const auto& [entity, ticks] : registry_.storage<EntityComponentTicks<T>>().each())
+    {
+        if (ticks.changed_ < tick)
+            continue;
+
+        if constexpr (!std::is_empty_v<T>)
+            callback(entity, registry_.get<T>(entity));
+        else
+            callback(entity);
+    }
+}
+
+template <class T> void EntityManager::OnTrackedComponentAdded(entt::registry& registry, entt::entity entity)
+{
+    registry.emplace_or_replace<EntityComponentTicks<T>>(entity, changeTick_, changeTick_);
+}
+
+template <class T> void EntityManager::OnTrackedComponentUpdated(entt::registry& registry, entt::entity entity)
+{
+    if (auto ticks = registry.try_get<EntityComponentTicks<T>>(entity))
+        ticks->changed_ = changeTick_;
+    else
+        registry.emplace<EntityComponentTicks<T>>(entity, changeTick_, changeTick_);
+}
+
+template <class T> void EntityManager::OnTrackedComponentRemoved(entt::registry& registry, entt::entity entity)
+{
+    registry.remove<EntityComponentTicks<T>>(entity);
+}
+
 template <class T>
 void EntityManager::SerializeComponents(Archive& archive, const char* name, entt::registry& registry, unsigned version)
 {
-    auto& storage = registry.storage<T>();
-    const auto numComponents = static_cast<unsigned>(storage.size());
-
-    const auto block = archive.OpenArrayBlock(name, numComponents);
     if (archive.IsInput())
     {
+        const auto block = archive.OpenArrayBlock(name, 0);
         for (unsigned i = 0; i < block.GetSizeHint(); ++i)
         {
             const auto elementBlock = archive.OpenUnorderedBlock("component");
@@ -265,10 +954,12 @@ void EntityManager::SerializeComponents(Archive& archive, const char* name, entt
             archive.Serialize("_entity", entityData);
             const auto entity = static_cast<entt::entity>(entityData);
 
+            // Deserialize first so that construction and update listeners observe loaded value.
             if constexpr (!std::is_empty_v<T>)
             {
-                auto& component = registry.emplace_or_replace<T>(entity);
+                T component{};
                 component.SerializeInBlock(archive, version);
+                registry.emplace_or_replace<T>(entity, ea::move(component));
             }
             else
             {
@@ -281,10 +972,10 @@ void EntityManager::SerializeComponents(Archive& archive, const char* name, entt
         static thread_local ea::vector<entt::entity> entitiesBuffer;
         auto& entities = entitiesBuffer;
 
-        const auto view = registry.view<T>();
-        entities.assign(view.begin(), view.end());
-        ea::sort(entities.begin(), entities.end(), EntityIndexComparator{});
+        CollectSerializedEntities(entities, registry, registry.view<T>(),
+            [&](entt::entity entity) { return IsComponentInherited<T>(registry, entity); });
 
+        const auto block = archive.OpenArrayBlock(name, entities.size());
         for (const entt::entity entity : entities)
         {
             const auto elementBlock = archive.OpenUnorderedBlock("component");
@@ -301,6 +992,137 @@ void EntityManager::SerializeComponents(Archive& archive, const char* name, entt
     }
 }
 
+template <class T> bool EntityManager::IsComponentInherited(entt::registry& registry, entt::entity entity)
+{
+    const entt::entity templateEntity = FindValidTemplate(registry, entity);
+    if (templateEntity == entt::null)
+        return false;
+
+    const auto& storage = registry.storage<T>();
+    if (!storage.contains(templateEntity))
+        return false;
+
+    if constexpr (std::is_empty_v<T>)
+        return true;
+    else if constexpr (IsEntityComponentComparable<T>::value)
+        return storage.get(entity) == storage.get(templateEntity);
+    else
+        return false;
+}
+
+template <class Range, class Predicate>
+void EntityManager::CollectSerializedEntities(
+    ea::vector<entt::entity>& entities, entt::registry& registry, const Range& range, const Predicate& isInherited)
+{
+    entities.assign(range.begin(), range.end());
+    if (!registry.storage<EntityTemplateRef>().empty())
+        entities.erase(ea::remove_if(entities.begin(), entities.end(), isInherited), entities.end());
+    ea::sort(entities.begin(), entities.end(), EntityIndexComparator{});
+}
+
+template <class T> bool EntityManager::SerializeComponentsSnapshot(Archive& archive, entt::registry& registry)
+{
+    auto& storage = registry.storage<T>();
+
+    static thread_local ea::vector<entt::entity> entitiesBuffer;
+    auto& entities = entitiesBuffer;
+
+    auto numComponents = static_cast<unsigned>(storage.size());
+    archive.SerializeVLE("size", numComponents);
+
+    if (!archive.IsInput())
+    {
+        entities.assign(storage.data(), storage.data() + numComponents);
+        archive.SerializeBytes("entities", entities.data(), numComponents * sizeof(entt::entity));
+
+        if constexpr (std::is_empty_v<T>)
+        {
+        }
+        else if constexpr (std::is_trivially_copyable_v<T>)
+        {
+            static thread_local ea::vector<T> valuesBuffer;
+            auto& values = valuesBuffer;
+
+            values.clear();
+            for (const entt::entity entity : entities)
+                values.push_back(storage.get(entity));
+            archive.SerializeBytes("values", values.data(), numComponents * sizeof(T));
+        }
+        else
+        {
+            for (const entt::entity entity : entities)
+            {
+                const auto elementBlock = archive.OpenUnorderedBlock("component");
+                storage.get(entity).SerializeInBlock(archive, T::Version);
+            }
+        }
+        return false;
+    }
+
+    entities.resize(numComponents);
+    archive.SerializeBytes("entities", entities.data(), numComponents * sizeof(entt::entity));
+
+    // If the set of entities is the same, values can be patched in place.
+    // Order is not compared because storages owned by groups are reordered whenever group membership changes,
+    // and rebuilding such storage from scratch would also shuffle all other storages owned by the group.
+    const bool sameEntities = storage.size() == numComponents
+        && ea::all_of(entities.begin(), entities.end(), [&](entt::entity entity) { return storage.contains(entity); });
+    if (!sameEntities)
+        registry.clear<T>();
+
+    if constexpr (std::is_empty_v<T>)
+    {
+        if (!sameEntities)
+            registry.insert<T>(entities.begin(), entities.end());
+        return !sameEntities;
+    }
+    else if constexpr (std::is_trivially_copyable_v<T>)
+    {
+        static thread_local ea::vector<T> valuesBuffer;
+        auto& values = valuesBuffer;
+
+        values.resize(numComponents);
+        archive.SerializeBytes("values", values.data(), numComponents * sizeof(T));
+
+        if (!sameEntities)
+        {
+            registry.insert<T>(entities.begin(), entities.end(), values.begin());
+            return true;
+        }
+
+        bool changed = false;
+        for (unsigned i = 0; i < numComponents; ++i)
+        {
+            if (memcmp(&storage.get(entities[i]), &values[i], sizeof(T)) != 0)
+            {
+                registry.replace<T>(entities[i], values[i]);
+                changed = true;
+            }
+        }
+        return changed;
+    }
+    else
+    {
+        bool changed = !sameEntities;
+        for (const entt::entity entity : entities)
+        {
+            const auto elementBlock = archive.OpenUnorderedBlock("component");
+
+            T component{};
+            component.SerializeInBlock(archive, T::Version);
+            if constexpr (IsEntityComponentComparable<T>::value)
+            {
+                if (sameEntities && storage.get(entity) == component)
+                    continue;
+            }
+
+            registry.emplace_or_replace<T>(entity, ea::move(component));
+            changed = true;
+        }
+        return changed;
+    }
+}
+
 template <class T> bool DefaultEntityComponentFactory<T>::HasComponent(entt::registry& registry, entt::entity entity)
 {
     const auto& storage = registry.storage<T>();
@@ -326,6 +1148,10 @@ void DefaultEntityComponentFactory<T>::SerializeComponent(
     {
         auto& component = registry.get<T>(entity);
         component.SerializeInBlock(archive, version);
+
+        // Notify listeners that component was modified in place.
+        if (archive.IsInput())
+            registry.patch<T>(entity);
     }
 }
 
@@ -369,4 +1195,86 @@ template <class T> void DefaultEntityComponentFactory<T>::CommitActions(entt::re
     pendingEditActions_.clear();
 }
 
+template <class T>
+bool DefaultEntityComponentFactory<T>::ConnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query)
+{
+    if (query.IsTriggeredOnAdded())
+        registry.on_construct<T>().template connect<&EntityReactiveQuery::OnTriggered>(query);
+    if (query.IsTriggeredOnUpdated())
+        registry.on_update<T>().template connect<&EntityReactiveQuery::OnTriggered>(query);
+    registry.on_destroy<T>().template connect<&EntityReactiveQuery::OnTriggerRemoved>(query);
+    return true;
+}
+
+template <class T>
+void DefaultEntityComponentFactory<T>::DisconnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query)
+{
+    registry.on_construct<T>().disconnect(&query);
+    registry.on_update<T>().disconnect(&query);
+    registry.on_destroy<T>().disconnect(&query);
+}
+
+template <class T>
+void DefaultEntityComponentFactory<T>::SerializeSnapshot(Archive& archive, entt::registry& registry)
+{
+    EntityManager::SerializeComponentsSnapshot<T>(archive, registry);
+}
+
+template <class T>
+void DefaultEntityComponentFactory<T>::MergeComponents(
+    entt::registry& registry, entt::registry& sourceRegistry, const EntityRemap& remap)
+{
+    auto& sourceStorage = sourceRegistry.storage<T>();
+
+    const ea::span<const entt::entity> sourceEntities{
+        sourceStorage.data(), static_cast<eastl_size_t>(sourceStorage.size())};
+
+    if constexpr (std::is_empty_v<T>)
+    {
+        static thread_local ea::vector<entt::entity> entitiesBuffer;
+        auto& entities = entitiesBuffer;
+
+        entities.clear();
+        for (const entt::entity sourceEntity : sourceEntities)
+            entities.push_back(remap.Remap(sourceEntity));
+
+        registry.insert<T>(entities.begin(), entities.end());
+        entities.clear();
+    }
+    else
+    {
+        auto& storage = registry.storage<T>();
+        storage.reserve(storage.size() + sourceEntities.size());
+
+        for (const entt::entity sourceEntity : sourceEntities)
+        {
+            // Value is remapped before emplacement so that construction listeners observe final value.
+            T value = sourceStorage.get(sourceEntity);
+            if constexpr (IsEntityRemappable<T>::value)
+                value.RemapEntities(remap);
+            registry.emplace<T>(remap.Remap(sourceEntity), ea::move(value));
+        }
+    }
+}
+
+template <class T>
+void DefaultEntityComponentFactory<T>::CloneComponent(
+    entt::registry& registry, entt::entity entity, ea::span<const entt::entity> clones)
+{
+    auto& storage = registry.storage<T>();
+    if (!storage.contains(entity))
+        return;
+
+    if constexpr (std::is_empty_v<T>)
+    {
+        registry.insert<T>(clones.begin(), clones.end());
+    }
+    else
+    {
+        // Storage may be reallocated on insertion, so the value is copied first.
+        const T value = storage.get(entity);
+        registry.insert<T>(clones.begin(), clones.end(), value);
+    }
+}
+
 } // namespace Urho3D
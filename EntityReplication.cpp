@@ -0,0 +1,365 @@
+#include "EntityReplication.h"
+
+#include <Urho3D/Core/Profiler.h>
+#include <Urho3D/IO/BinaryArchive.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/Scene/Node.h>
+
+namespace Urho3D
+{
+
+namespace
+{
+
+/// Rough upper bound of message header size: two VLE counters.
+const unsigned messageHeaderSize = 10;
+/// Smoothing factor of per-entity change rate.
+const float changeRateSmoothing = 0.2f;
+
+void EncodeComponent(Context* context, VectorBuffer& dest, EntityComponentFactory* factory, entt::registry& registry,
+    entt::entity entity, const QuantizationHints* hints)
+{
+    dest.Clear();
+    if (hints)
+    {
+        BitPackedOutputArchive archive{context, hints};
+        archive.SetHintScope(factory->GetName());
+        ConsumeArchiveException([&] { factory->SerializeComponent(archive, registry, entity, factory->GetVersion()); });
+
+        const ByteVector& data = archive.GetData();
+        dest.Write(data.data(), data.size());
+        return;
+    }
+
+    BinaryOutputArchive archive{context, dest};
+    ConsumeArchiveException(
+        [&]
+    {
+        const auto block = archive.OpenUnorderedBlock("component");
+        factory->SerializeComponent(archive, registry, entity, factory->GetVersion());
+    });
+}
+
+void DecodeComponent(Context* context, const ByteVector& data, EntityComponentFactory* factory,
+    entt::registry& registry, entt::entity entity, const QuantizationHints* hints)
+{
+    if (hints)
+    {
+        BitPackedInputArchive archive{context, data, hints};
+        archive.SetHintScope(factory->GetName());
+        ConsumeArchiveException([&] { factory->SerializeComponent(archive, registry, entity, factory->GetVersion()); });
+        return;
+    }
+
+    MemoryBuffer buffer{data};
+    BinaryInputArchive archive{context, buffer};
+    ConsumeArchiveException(
+        [&]
+    {
+        const auto block = archive.OpenUnorderedBlock("component");
+        factory->SerializeComponent(archive, registry, entity, factory->GetVersion());
+    });
+}
+
+} // namespace
+
+EntityReplicationSender::EntityReplicationSender(EntityManager* manager)
+    : manager_(manager)
+{
+    for (const auto& factory : manager->GetComponentTypes())
+    {
+        // Types without reactive queries keep their index so that component indices match on the receiving side.
+        EntityReactiveQuery* query = manager->CreateReactiveQuery(factory->GetName(), true, true);
+        if (query)
+            query->SetCollectRemoved(true);
+        else
+            URHO3D_LOGWARNING("Component '{}' changes are not tracked and are replicated on spawn only",
+                factory->GetName());
+
+        componentTypes_.push_back(factory.get());
+        dirtyQueries_.push_back(query);
+    }
+}
+
+EntityReplicationSender::~EntityReplicationSender()
+{
+    if (manager_)
+    {
+        for (EntityReactiveQuery* query : dirtyQueries_)
+        {
+            if (query)
+                manager_->RemoveReactiveQuery(query);
+        }
+    }
+}
+
+EntityInterestCallback EntityReplicationSender::MakeDistanceInterest(
+    EntityManager* manager, const Vector3& origin, float radius)
+{
+    WeakPtr<EntityManager> weakManager{manager};
+    return [weakManager, origin, radius](entt::registry& registry, entt::entity entity)
+    {
+        Node* node = weakManager ? weakManager->EntityToNode(entity) : nullptr;
+        if (!node)
+            return 0.0f;
+
+        const float distance = (node->GetWorldPosition() - origin).Length();
+        if (distance > radius)
+            return 0.0f;
+
+        // Closer entities are more important, but every entity within radius has some weight.
+        return ea::max(1.0f - distance / radius, M_EPSILON);
+    };
+}
+
+unsigned EntityReplicationSender::GetNumReplicatedEntities() const
+{
+    unsigned result = 0;
+    for (const auto& [entity, state] : entities_.each())
+    {
+        if (state.spawned_)
+            ++result;
+    }
+    return result;
+}
+
+void EntityReplicationSender::CollectDirtyComponents()
+{
+    for (unsigned index = 0; index < dirtyQueries_.size(); ++index)
+    {
+        EntityReactiveQuery* query = dirtyQueries_[index];
+        if (!query)
+            continue;
+
+        for (const entt::entity entity : query->GetEntities())
+        {
+            if (entities_.contains(entity))
+                entities_.get(entity).dirtyComponents_[index] = true;
+        }
+        query->Clear();
+    }
+}
+
+void EntityReplicationSender::UpdateInterest()
+{
+    entt::registry& registry = manager_->Registry();
+
+    for (const auto& [entity, state] : entities_.each())
+        state.interested_ = false;
+
+    for (const entt::entity entity : manager_->GetEntities())
+    {
+        const float weight = interest_ ? interest_(registry, entity) : 1.0f;
+        if (weight <= 0.0f)
+            continue;
+
+        // Newly interesting entity is sent in full.
+        const bool isNew = !entities_.contains(entity);
+        EntityState& state = isNew ? entities_.emplace(entity) : entities_.get(entity);
+        if (isNew)
+            state.dirtyComponents_.resize(componentTypes_.size(), true);
+
+        state.interested_ = true;
+        state.weight_ = weight;
+    }
+
+    despawnedEntities_.clear();
+    removedEntities_.clear();
+    for (const auto& [entity, state] : entities_.each())
+    {
+        if (state.interested_)
+            continue;
+
+        removedEntities_.push_back(entity);
+        if (state.spawned_)
+            despawnedEntities_.push_back(entity);
+    }
+
+    for (const entt::entity entity : removedEntities_)
+        entities_.erase(entity);
+}
+
+void EntityReplicationSender::WriteEntity(VectorBuffer& dest, entt::entity entity, EntityState& state)
+{
+    entt::registry& registry = manager_->Registry();
+    Context* context = manager_->GetContext();
+
+    unsigned numComponents = 0;
+    for (bool dirty : state.dirtyComponents_)
+        numComponents += dirty ? 1 : 0;
+
+    dest.WriteUInt(static_cast<unsigned>(entity));
+    dest.WriteBool(!state.spawned_);
+    dest.WriteVLE(numComponents);
+
+    for (unsigned index = 0; index < componentTypes_.size(); ++index)
+    {
+        if (!state.dirtyComponents_[index])
+            continue;
+
+        EntityComponentFactory* factory = componentTypes_[index];
+        const bool exists = factory->HasComponent(registry, entity);
+
+        dest.WriteVLE(index);
+        dest.WriteBool(exists);
+        if (exists)
+        {
+            EncodeComponent(context, componentBuffer_, factory, registry, entity, hints_.get());
+            dest.WriteBuffer(componentBuffer_.GetBuffer());
+        }
+    }
+}
+
+void EntityReplicationSender::WriteTick(Serializer& dest, unsigned maxBytes)
+{
+    if (!manager_)
+        return;
+
+    URHO3D_PROFILE("EntityReplicationSender::WriteTick");
+
+    CollectDirtyComponents();
+    UpdateInterest();
+
+    // Accumulate priority of entities that have something to send.
+    candidates_.clear();
+    for (const auto& [entity, state] : entities_.each())
+    {
+        const bool hasChanges = ea::find(state.dirtyComponents_.begin(), state.dirtyComponents_.end(), true)
+            != state.dirtyComponents_.end();
+        state.changeRate_ += ((hasChanges ? 1.0f : 0.0f) - state.changeRate_) * changeRateSmoothing;
+
+        if (!hasChanges && state.spawned_)
+            continue;
+
+        state.priority_ += state.weight_ * (1.0f + state.changeRate_);
+        candidates_.emplace_back(state.priority_, entity);
+    }
+    ea::sort(candidates_.begin(), candidates_.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.first > rhs.first; });
+
+    // Despawns are small and always sent.
+    dest.WriteVLE(despawnedEntities_.size());
+    for (const entt::entity entity : despawnedEntities_)
+        dest.WriteUInt(static_cast<unsigned>(entity));
+
+    updatesBuffer_.Clear();
+    unsigned numUpdates = 0;
+    const auto headerSize = static_cast<unsigned>(messageHeaderSize + despawnedEntities_.size() * sizeof(unsigned));
+    for (const auto& [priority, entity] : candidates_)
+    {
+        EntityState& state = entities_.get(entity);
+
+        entityBuffer_.Clear();
+        WriteEntity(entityBuffer_, entity, state);
+
+        const unsigned messageSize = headerSize + updatesBuffer_.GetSize() + entityBuffer_.GetSize();
+        if (numUpdates != 0 && messageSize > maxBytes)
+            break;
+
+        updatesBuffer_.Write(entityBuffer_.GetData(), entityBuffer_.GetSize());
+        ++numUpdates;
+
+        state.spawned_ = true;
+        state.priority_ = 0.0f;
+        ea::fill(state.dirtyComponents_.begin(), state.dirtyComponents_.end(), false);
+    }
+
+    dest.WriteVLE(numUpdates);
+    dest.Write(updatesBuffer_.GetData(), updatesBuffer_.GetSize());
+}
+
+EntityReplicationReceiver::EntityReplicationReceiver(EntityManager* manager)
+    : manager_(manager)
+{
+}
+
+entt::entity EntityReplicationReceiver::RemoteToLocal(entt::entity remoteEntity) const
+{
+    return remoteToLocal_.contains(remoteEntity) ? remoteToLocal_.get(remoteEntity).entity_ : entt::null;
+}
+
+void EntityReplicationReceiver::DespawnEntity(entt::entity remoteEntity)
+{
+    const entt::entity localEntity = RemoteToLocal(remoteEntity);
+    if (localEntity == entt::null)
+        return;
+
+    // Destruction is deferred so that it is safe to despawn entities while they are iterated.
+    remoteToLocal_.erase(remoteEntity);
+    manager_->QueueDestroyEntity(localEntity);
+}
+
+bool EntityReplicationReceiver::ReadTick(Deserializer& src)
+{
+    if (!manager_)
+        return false;
+
+    URHO3D_PROFILE("EntityReplicationReceiver::ReadTick");
+
+    entt::registry& registry = manager_->Registry();
+    Context* context = manager_->GetContext();
+    const auto& componentTypes = manager_->GetComponentTypes();
+
+    const unsigned numDespawns = src.ReadVLE();
+    for (unsigned i = 0; i < numDespawns; ++i)
+        DespawnEntity(static_cast<entt::entity>(src.ReadUInt()));
+
+    spawnedEntities_.clear();
+    const unsigned numUpdates = src.ReadVLE();
+    for (unsigned i = 0; i < numUpdates; ++i)
+    {
+        const auto remoteEntity = static_cast<entt::entity>(src.ReadUInt());
+        const bool spawn = src.ReadBool();
+
+        entt::entity localEntity = RemoteToLocal(remoteEntity);
+        if (spawn && localEntity == entt::null)
+        {
+            localEntity = registry.create();
+            remoteToLocal_.emplace(remoteEntity, LocalEntity{localEntity});
+            if (materializeEntities_ && manager_->GetScene())
+                spawnedEntities_.push_back(localEntity);
+        }
+
+        if (!manager_->IsEntityValid(localEntity))
+        {
+            URHO3D_LOGERROR("Cannot apply replicated update to unknown entity {}", remoteEntity);
+            return false;
+        }
+
+        const unsigned numComponents = src.ReadVLE();
+        for (unsigned j = 0; j < numComponents; ++j)
+        {
+            const unsigned index = src.ReadVLE();
+            const bool exists = src.ReadBool();
+            if (index >= componentTypes.size())
+            {
+                URHO3D_LOGERROR("Cannot apply replicated component #{} to entity {}", index, remoteEntity);
+                return false;
+            }
+
+            EntityComponentFactory* factory = componentTypes[index].get();
+            if (exists)
+            {
+                const ByteVector data = src.ReadBuffer();
+                if (!factory->HasComponent(registry, localEntity))
+                    factory->CreateComponent(registry, localEntity);
+                DecodeComponent(context, data, factory, registry, localEntity, hints_.get());
+            }
+            else if (factory->HasComponent(registry, localEntity))
+            {
+                factory->DestroyComponent(registry, localEntity);
+            }
+        }
+    }
+
+    // Entities are materialized after all components are applied, so listeners observe complete entities.
+    for (const entt::entity entity : spawnedEntities_)
+    {
+        if (manager_->IsEntityValid(entity) && !manager_->IsEntityMaterialized(entity))
+            manager_->MaterializeEntity(entity);
+    }
+
+    return true;
+}
+
+} // namespace Urho3D
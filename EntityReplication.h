@@ -0,0 +1,117 @@
+#pragma once
+
+#include "EntityManager.h"
+
+#include <Urho3D/IO/Deserializer.h>
+#include <Urho3D/IO/Serializer.h>
+
+#include <entt/entt.hpp>
+
+namespace Urho3D
+{
+
+/// Return replication weight of the entity for the observer. Zero or negative weight means no interest.
+using EntityInterestCallback = ea::function<float(entt::registry& registry, entt::entity entity)>;
+
+/// Generates replication stream of EntityManager for single observer.
+/// Each tick contains entity despawns and spawns/component deltas of entities the observer is interested in.
+/// Entities with pending changes are prioritized by interest weight and change rate and packed under byte budget.
+/// Component changes are detected via construct/update/destroy signals,
+/// so components should be modified via patch or replace to be replicated.
+/// All component types should be registered before sender is created and match on the receiving side.
+/// Component types that don't support reactive queries are replicated only when the entity is spawned.
+class PLUGIN_CORE_ENTITYMANAGER_API EntityReplicationSender
+{
+public:
+    explicit EntityReplicationSender(EntityManager* manager);
+    ~EntityReplicationSender();
+
+    /// Set interest callback. All entities are replicated with equal weight by default.
+    void SetInterest(const EntityInterestCallback& callback) { interest_ = callback; }
+    /// Create interest callback that selects materialized entities within radius from the origin.
+    static EntityInterestCallback MakeDistanceInterest(EntityManager* manager, const Vector3& origin, float radius);
+    /// Set quantization hints. Components are bit-packed if hints are set, hints should match on the receiving side.
+    void SetQuantizationHints(const QuantizationHints& hints) { hints_ = ea::make_unique<QuantizationHints>(hints); }
+
+    /// Write replication message for current tick.
+    /// Message size doesn't exceed the budget unless single entity doesn't fit into empty message.
+    void WriteTick(Serializer& dest, unsigned maxBytes);
+
+    /// Return number of entities known to the observer.
+    unsigned GetNumReplicatedEntities() const;
+
+private:
+    struct EntityState
+    {
+        /// Whether the entity was sent to the observer at least once.
+        bool spawned_{};
+        /// Whether the entity was seen as interesting during current tick.
+        bool interested_{};
+        float weight_{};
+        float priority_{};
+        float changeRate_{};
+        /// Components changed since the last time the entity was sent.
+        ea::vector<bool> dirtyComponents_;
+    };
+
+    void CollectDirtyComponents();
+    void UpdateInterest();
+    void WriteEntity(VectorBuffer& dest, entt::entity entity, EntityState& state);
+
+    WeakPtr<EntityManager> manager_;
+    EntityInterestCallback interest_;
+    ea::unique_ptr<QuantizationHints> hints_;
+
+    ea::vector<EntityComponentFactory*> componentTypes_;
+    ea::vector<EntityReactiveQuery*> dirtyQueries_;
+
+    entt::storage<EntityState> entities_;
+
+    /// Temporary buffers reused between ticks.
+    /// @{
+    ea::vector<entt::entity> despawnedEntities_;
+    ea::vector<entt::entity> removedEntities_;
+    ea::vector<ea::pair<float, entt::entity>> candidates_;
+    VectorBuffer entityBuffer_;
+    VectorBuffer updatesBuffer_;
+    VectorBuffer componentBuffer_;
+    /// @}
+};
+
+/// Applies replication stream produced by EntityReplicationSender to another EntityManager.
+/// Remote entities are mapped to locally created entities.
+/// Spawned entities are materialized if the manager is in a scene, unless disabled.
+class PLUGIN_CORE_ENTITYMANAGER_API EntityReplicationReceiver
+{
+public:
+    explicit EntityReplicationReceiver(EntityManager* manager);
+
+    /// Read and apply replication message.
+    bool ReadTick(Deserializer& src);
+
+    /// Return local entity for remote entity, or null.
+    entt::entity RemoteToLocal(entt::entity remoteEntity) const;
+    /// Set quantization hints. Should match hints of the sender.
+    void SetQuantizationHints(const QuantizationHints& hints) { hints_ = ea::make_unique<QuantizationHints>(hints); }
+    /// Set whether spawned entities are materialized.
+    void SetMaterializeEntities(bool enable) { materializeEntities_ = enable; }
+
+private:
+    /// Wrapper to avoid specialized storage of entt::entity.
+    struct LocalEntity
+    {
+        entt::entity entity_{entt::null};
+    };
+
+    void DespawnEntity(entt::entity remoteEntity);
+
+    WeakPtr<EntityManager> manager_;
+    ea::unique_ptr<QuantizationHints> hints_;
+    entt::storage<LocalEntity> remoteToLocal_;
+    bool materializeEntities_{true};
+
+    /// Entities spawned during current tick. Temporary buffer reused between ticks.
+    ea::vector<entt::entity> spawnedEntities_;
+};
+
+} // namespace Urho3D
@@ -0,0 +1,380 @@
+#pragma once
+
+#include "EntityValueIndex.h"
+
+#include <Urho3D/Core/Profiler.h>
+#include <Urho3D/Math/BoundingBox.h>
+
+#include <EASTL/sort.h>
+
+namespace Urho3D
+{
+
+/// Uniform grid of entities indexed by position projected from component T.
+/// Index is kept up to date via construct, update and destroy signals.
+/// Components modified in place should be patched or passed to UpdateEntity.
+template <class T> class EntitySpatialIndex : public EntityValueIndexBase
+{
+public:
+    using Projection = ea::function<Vector3(const T& component)>;
+    static_assert(!std::is_empty_v<T>, "Empty components cannot be indexed by position");
+
+    EntitySpatialIndex(EntityManager* manager, const Projection& projection, float cellSize);
+    ~EntitySpatialIndex() override;
+
+    /// Reindex single entity after its component was modified in place.
+    void UpdateEntity(entt::entity entity);
+    /// Rebuild the whole index. Positions are evaluated on worker threads.
+    void Rebuild();
+
+    /// Queries. Found entities are appended to the result.
+    /// @{
+    void QueryRadius(const Vector3& center, float radius, ea::vector<entt::entity>& result) const;
+    void QueryBox(const BoundingBox& box, ea::vector<entt::entity>& result) const;
+    /// Find up to count nearest entities within max distance, ordered by distance.
+    void QueryNearest(const Vector3& center, unsigned count, float maxDistance, ea::vector<entt::entity>& result) const;
+    /// @}
+
+    float GetCellSize() const { return cellSize_; }
+    unsigned GetNumCells() const { return cells_.size(); }
+    unsigned GetNumEntities() const { return static_cast<unsigned>(entityCells_.size()); }
+
+private:
+    using CellKey = unsigned long long;
+
+    struct EntityCell
+    {
+        Vector3 position_;
+        CellKey cellKey_{};
+        /// Position of the entity in the list of entities in the cell.
+        unsigned indexInCell_{};
+    };
+
+    static constexpr unsigned BitsPerAxis = 21;
+    static constexpr int AxisBias = 1 << (BitsPerAxis - 1);
+    static constexpr int AxisMask = (1 << BitsPerAxis) - 1;
+
+    IntVector3 GetCellCoordinates(const Vector3& position) const;
+    static CellKey GetCellKey(const IntVector3& coordinates);
+    static IntVector3 GetCellCoordinates(CellKey cellKey);
+
+    void AddEntity(entt::entity entity, const Vector3& position);
+    void RemoveEntity(entt::entity entity);
+    /// Iterate cells overlapping the box, or occupied cells if the box covers more cells than are occupied.
+    template <class Callback> void ForEachCell(const BoundingBox& box, const Callback& callback) const;
+
+    void OnConstruct(entt::registry& registry, entt::entity entity);
+    void OnUpdate(entt::registry& registry, entt::entity entity);
+    void OnDestroy(entt::registry& registry, entt::entity entity);
+
+    WeakPtr<EntityManager> manager_;
+    entt::registry& registry_;
+    Projection projection_;
+    float cellSize_{};
+
+    ea::unordered_map<CellKey, ea::vector<entt::entity>> cells_;
+    entt::storage<EntityCell> entityCells_;
+
+    /// Temporary buffer for nearest queries.
+    mutable ea::vector<ea::pair<float, entt::entity>> candidates_;
+};
+
+template <class T>
+EntitySpatialIndex<T>* EntityManager::AddSpatialIndex(
+    const ea::function<Vector3(const T& component)>& projection, float cellSize)
+{
+    auto index = ea::make_unique<EntitySpatialIndex<T>>(this, projection, cellSize);
+    const auto result = index.get();
+    valueIndices_.push_back(ea::move(index));
+    return result;
+}
+
+template <class T>
+EntitySpatialIndex<T>::EntitySpatialIndex(EntityManager* manager, const Projection& projection, float cellSize)
+    : manager_(manager)
+    , registry_(manager->Registry())
+    , projection_(projection)
+    , cellSize_(ea::max(cellSize, M_EPSILON))
+{
+    registry_.on_construct<T>().template connect<&EntitySpatialIndex::OnConstruct>(*this);
+    registry_.on_update<T>().template connect<&EntitySpatialIndex::OnUpdate>(*this);
+    registry_.on_destroy<T>().template connect<&EntitySpatialIndex::OnDestroy>(*this);
+
+    Rebuild();
+}
+
+template <class T> EntitySpatialIndex<T>::~EntitySpatialIndex()
+{
+    registry_.on_construct<T>().disconnect(this);
+    registry_.on_update<T>().disconnect(this);
+    registry_.on_destroy<T>().disconnect(this);
+}
+
+template <class T> IntVector3 EntitySpatialIndex<T>::GetCellCoordinates(const Vector3& position) const
+{
+    const auto toCell = [this](float value)
+    { return Clamp(FloorToInt(value / cellSize_), -AxisBias, AxisBias - 1); };
+    return {toCell(position.x_), toCell(position.y_), toCell(position.z_)};
+}
+
+template <class T>
+typename EntitySpatialIndex<T>::CellKey EntitySpatialIndex<T>::GetCellKey(const IntVector3& coordinates)
+{
+    const auto pack = [](int value) { return static_cast<CellKey>((value + AxisBias) & AxisMask); };
+    return pack(coordinates.x_) | (pack(coordinates.y_) << BitsPerAxis)
+        | (pack(coordinates.z_) << (2 * BitsPerAxis));
+}
+
+template <class T> IntVector3 EntitySpatialIndex<T>::GetCellCoordinates(CellKey cellKey)
+{
+    const auto unpack = [](CellKey value) { return static_cast<int>(value & AxisMask) - AxisBias; };
+    return {unpack(cellKey), unpack(cellKey >> BitsPerAxis), unpack(cellKey >> (2 * BitsPerAxis))};
+}
+
+template <class T> void EntitySpatialIndex<T>::AddEntity(entt::entity entity, const Vector3& position)
+{
+    const CellKey cellKey = GetCellKey(GetCellCoordinates(position));
+    ea::vector<entt::entity>& cell = cells_[cellKey];
+    entityCells_.emplace(entity, EntityCell{position, cellKey, static_cast<unsigned>(cell.size())});
+    cell.push_back(entity);
+}
+
+template <class T> void EntitySpatialIndex<T>::RemoveEntity(entt::entity entity)
+{
+    if (!entityCells_.contains(entity))
+        return;
+
+    const EntityCell entityCell = entityCells_.get(entity);
+    const auto iter = cells_.find(entityCell.cellKey_);
+    URHO3D_ASSERT(iter != cells_.end());
+
+    // Move the last entity into the vacant position.
+    ea::vector<entt::entity>& cell = iter->second;
+    const entt::entity lastEntity = cell.back();
+    cell[entityCell.indexInCell_] = lastEntity;
+    entityCells_.get(lastEntity).indexInCell_ = entityCell.indexInCell_;
+    cell.pop_back();
+
+    if (cell.empty())
+        cells_.erase(iter);
+    entityCells_.erase(entity);
+}
+
+template <class T> void EntitySpatialIndex<T>::UpdateEntity(entt::entity entity)
+{
+    const T* component = registry_.try_get<T>(entity);
+    if (!component)
+    {
+        RemoveEntity(entity);
+        return;
+    }
+
+    const Vector3 position = projection_(*component);
+    if (entityCells_.contains(entity))
+    {
+        // Moving within the cell doesn't change the cell lists.
+        EntityCell& entityCell = entityCells_.get(entity);
+        if (entityCell.cellKey_ == GetCellKey(GetCellCoordinates(position)))
+        {
+            entityCell.position_ = position;
+            return;
+        }
+        RemoveEntity(entity);
+    }
+    AddEntity(entity, position);
+}
+
+template <class T> void EntitySpatialIndex<T>::Rebuild()
+{
+    URHO3D_PROFILE("EntitySpatialIndex::Rebuild");
+
+    cells_.clear();
+    entityCells_.clear();
+
+    const auto& storage = registry_.storage<T>();
+    const ea::span<const entt::entity> entities{storage.data(), static_cast<eastl_size_t>(storage.size())};
+    const auto numEntities = static_cast<unsigned>(entities.size());
+
+    // Projection is evaluated in parallel, the cells are filled sequentially.
+    static thread_local ea::vector<Vector3> positionsBuffer;
+    auto& positions = positionsBuffer;
+    positions.resize(numEntities);
+
+    const unsigned chunkSize = manager_ ? manager_->GetParallelChunkSize(numEntities, sizeof(T)) : numEntities;
+    const unsigned numChunks = chunkSize != 0 ? EntityManager::GetNumEntitiesChunks(entities, chunkSize) : 0;
+    const auto processChunk = [&](unsigned chunkIndex)
+    {
+        const unsigned begin = chunkIndex * chunkSize;
+        const unsigned end = ea::min(begin + chunkSize, numEntities);
+        for (unsigned i = begin; i < end; ++i)
+            positions[i] = projection_(storage.get(entities[i]));
+    };
+
+    if (manager_)
+        manager_->ParallelForChunks(numChunks, processChunk);
+    else
+    {
+        for (unsigned chunkIndex = 0; chunkIndex < numChunks; ++chunkIndex)
+            processChunk(chunkIndex);
+    }
+
+    entityCells_.reserve(numEntities);
+    for (unsigned i = 0; i < numEntities; ++i)
+        AddEntity(entities[i], positions[i]);
+}
+
+template <class T>
+template <class Callback>
+void EntitySpatialIndex<T>::ForEachCell(const BoundingBox& box, const Callback& callback) const
+{
+    const IntVector3 minCell = GetCellCoordinates(box.min_);
+    const IntVector3 maxCell = GetCellCoordinates(box.max_);
+    const IntVector3 size = maxCell - minCell + IntVector3::ONE;
+    const auto numCellsInBox = static_cast<unsigned long long>(size.x_) * size.y_ * size.z_;
+
+    if (numCellsInBox > cells_.size())
+    {
+        for (const auto& [cellKey, cell] : cells_)
+        {
+            const IntVector3 coordinates = GetCellCoordinates(cellKey);
+            if (coordinates.x_ >= minCell.x_ && coordinates.x_ <= maxCell.x_ && coordinates.y_ >= minCell.y_
+                && coordinates.y_ <= maxCell.y_ && coordinates.z_ >= minCell.z_ && coordinates.z_ <= maxCell.z_)
+                callback(cell);
+        }
+        return;
+    }
+
+    for (int z = minCell.z_; z <= maxCell.z_; ++z)
+    {
+        for (int y = minCell.y_; y <= maxCell.y_; ++y)
+        {
+            for (int x = minCell.x_; x <= maxCell.x_; ++x)
+            {
+                const auto iter = cells_.find(GetCellKey(IntVector3{x, y, z}));
+                if (iter != cells_.end())
+                    callback(iter->second);
+            }
+        }
+    }
+}
+
+template <class T>
+void EntitySpatialIndex<T>::QueryRadius(const Vector3& center, float radius, ea::vector<entt::entity>& result) const
+{
+    const float radiusSquared = radius * radius;
+    const BoundingBox box{center - Vector3::ONE * radius, center + Vector3::ONE * radius};
+    ForEachCell(box,
+        [&](const ea::vector<entt::entity>& cell)
+    {
+        for (const entt::entity entity : cell)
+        {
+            if ((entityCells_.get(entity).position_ - center).LengthSquared() <= radiusSquared)
+                result.push_back(entity);
+        }
+    });
+}
+
+template <class T> void EntitySpatialIndex<T>::QueryBox(const BoundingBox& box, ea::vector<entt::entity>& result) const
+{
+    ForEachCell(box,
+        [&](const ea::vector<entt::entity>& cell)
+    {
+        for (const entt::entity entity : cell)
+        {
+            if (box.IsInside(entityCells_.get(entity).position_) != OUTSIDE)
+                result.push_back(entity);
+        }
+    });
+}
+
+template <class T>
+void EntitySpatialIndex<T>::QueryNearest(
+    const Vector3& center, unsigned count, float maxDistance, ea::vector<entt::entity>& result) const
+{
+    if (count == 0 || cells_.empty())
+        return;
+
+    candidates_.clear();
+    const float maxDistanceSquared = maxDistance * maxDistance;
+    const IntVector3 centerCell = GetCellCoordinates(center);
+    const auto maxRing = static_cast<int>(ea::min(maxDistance / cellSize_ + 1.0f, static_cast<float>(AxisBias)));
+
+    const auto addCandidates = [&](const ea::vector<entt::entity>& cell)
+    {
+        for (const entt::entity entity : cell)
+        {
+            const float distanceSquared = (entityCells_.get(entity).position_ - center).LengthSquared();
+            if (distanceSquared <= maxDistanceSquared)
+                candidates_.emplace_back(distanceSquared, entity);
+        }
+    };
+
+    // Visit cells in expanding rings until the nearest entities are known for sure.
+    for (int ring = 0; ring <= maxRing; ++ring)
+    {
+        const auto ringSize = static_cast<unsigned long long>(2 * ring + 1);
+        if (ringSize * ringSize * ringSize > cells_.size())
+        {
+            // Remaining occupied cells are fewer than cells in the ring, visit them directly.
+            for (const auto& [cellKey, cell] : cells_)
+            {
+                const IntVector3 offset = GetCellCoordinates(cellKey) - centerCell;
+                if (ea::max(Abs(offset.x_), ea::max(Abs(offset.y_), Abs(offset.z_))) >= ring)
+                    addCandidates(cell);
+            }
+            break;
+        }
+
+        for (int z = -ring; z <= ring; ++z)
+        {
+            for (int y = -ring; y <= ring; ++y)
+            {
+                for (int x = -ring; x <= ring; ++x)
+                {
+                    if (ea::max(Abs(x), ea::max(Abs(y), Abs(z))) != ring)
+                        continue;
+
+                    const auto iter = cells_.find(GetCellKey(centerCell + IntVector3{x, y, z}));
+                    if (iter != cells_.end())
+                        addCandidates(iter->second);
+                }
+            }
+        }
+
+        // Entities in further rings are at least this far away.
+        const float ringDistance = ring * cellSize_;
+        if (candidates_.size() >= count)
+        {
+            ea::partial_sort(candidates_.begin(), candidates_.begin() + count, candidates_.end());
+            candidates_.resize(count);
+            if (candidates_.back().first <= ringDistance * ringDistance)
+                break;
+        }
+    }
+
+    if (candidates_.size() > count)
+    {
+        ea::partial_sort(candidates_.begin(), candidates_.begin() + count, candidates_.end());
+        candidates_.resize(count);
+    }
+    ea::sort(candidates_.begin(), candidates_.end());
+    for (const auto& [distanceSquared, entity] : candidates_)
+        result.push_back(entity);
+}
+
+template <class T> void EntitySpatialIndex<T>::OnConstruct(entt::registry& registry, entt::entity entity)
+{
+    AddEntity(entity, projection_(registry.get<T>(entity)));
+}
+
+template <class T> void EntitySpatialIndex<T>::OnUpdate(entt::registry& registry, entt::entity entity)
+{
+    UpdateEntity(entity);
+}
+
+template <class T> void EntitySpatialIndex<T>::OnDestroy(entt::registry& registry, entt::entity entity)
+{
+    RemoveEntity(entity);
+}
+
+} // namespace Urho3D
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "EntityManager.h"
+
+#include <EASTL/map.h>
+#include <EASTL/unordered_map.h>
+
+namespace Urho3D
+{
+
+/// Base class of secondary indexes owned by EntityManager.
+class PLUGIN_CORE_ENTITYMANAGER_API EntityValueIndexBase
+{
+public:
+    virtual ~EntityValueIndexBase() = default;
+};
+
+/// Secondary index of entities by value projected from component T.
+/// Index is kept up to date via construct, update and destroy signals,
+/// so components should be modified via patch or replace to be reindexed.
+template <class T, class Key, class Map> class EntityValueIndex : public EntityValueIndexBase
+{
+public:
+    using Projection = ea::function<Key(const T& component)>;
+
+    EntityValueIndex(entt::registry& registry, const Projection& projection);
+    ~EntityValueIndex() override;
+
+    /// Return entities with exactly matching key. Span is invalidated by any change of the indexed component.
+    ea::span<const entt::entity> Find(const Key& key) const;
+    /// Return key of indexed entity.
+    const Key* GetKey(entt::entity entity) const;
+    unsigned GetNumKeys() const { return entitiesByKey_.size(); }
+
+protected:
+    struct EntityKey
+    {
+        Key key_{};
+        /// Position of the entity in the list of entities with the same key.
+        unsigned position_{};
+    };
+
+    void AddEntity(entt::entity entity, const Key& key);
+    void RemoveEntity(entt::entity entity);
+
+    void OnConstruct(entt::registry& registry, entt::entity entity);
+    void OnUpdate(entt::registry& registry, entt::entity entity);
+    void OnDestroy(entt::registry& registry, entt::entity entity);
+
+    entt::registry& registry_;
+    Projection projection_;
+
+    Map entitiesByKey_;
+    entt::storage<EntityKey> keys_;
+};
+
+/// Hash index that supports equality lookups.
+template <class T, class Key>
+class EntityHashIndex : public EntityValueIndex<T, Key, ea::unordered_map<Key, ea::vector<entt::entity>>>
+{
+public:
+    using EntityValueIndex<T, Key, ea::unordered_map<Key, ea::vector<entt::entity>>>::EntityValueIndex;
+};
+
+/// Ordered index that supports equality and range lookups.
+template <class T, class Key>
+class EntityOrderedIndex : public EntityValueIndex<T, Key, ea::map<Key, ea::vector<entt::entity>>>
+{
+public:
+    using EntityValueIndex<T, Key, ea::map<Key, ea::vector<entt::entity>>>::EntityValueIndex;
+
+    /// Return entities with keys in inclusive range ordered by key.
+    /// Span is valid until the next range lookup.
+    ea::span<const entt::entity> FindRange(const Key& minKey, const Key& maxKey);
+
+private:
+    ea::vector<entt::entity> rangeResult_;
+};
+
+template <class T, class Key>
+EntityHashIndex<T, Key>* EntityManager::AddHashIndex(const ea::function<Key(const T& component)>& projection)
+{
+    auto index = ea::make_unique<EntityHashIndex<T, Key>>(registry_, projection);
+    const auto result = index.get();
+    valueIndices_.push_back(ea::move(index));
+    return result;
+}
+
+template <class T, class Key>
+EntityOrderedIndex<T, Key>* EntityManager::AddOrderedIndex(const ea::function<Key(const T& component)>& projection)
+{
+    auto index = ea::make_unique<EntityOrderedIndex<T, Key>>(registry_, projection);
+    const auto result = index.get();
+    valueIndices_.push_back(ea::move(index));
+    return result;
+}
+
+template <class T, class Key, class Map>
+EntityValueIndex<T, Key, Map>::EntityValueIndex(entt::registry& registry, const Projection& projection)
+    : registry_(registry)
+    , projection_(projection)
+{
+    static_assert(!std::is_empty_v<T>, "Empty components cannot be indexed by value");
+
+    registry_.on_construct<T>().template connect<&EntityValueIndex::OnConstruct>(*this);
+    registry_.on_update<T>().template connect<&EntityValueIndex::OnUpdate>(*this);
+    registry_.on_destroy<T>().template connect<&EntityValueIndex::OnDestroy>(*this);
+
+    for (const auto& [entity, component] : registry_.storage<T>().each())
+        AddEntity(entity, projection_(component));
+}
+
+template <class T, class Key, class Map> EntityValueIndex<T, Key, Map>::~EntityValueIndex()
+{
+    registry_.on_construct<T>().disconnect(this);
+    registry_.on_update<T>().disconnect(this);
+    registry_.on_destroy<T>().disconnect(this);
+}
+
+template <class T, class Key, class Map>
+ea::span<const entt::entity> EntityValueIndex<T, Key, Map>::Find(const Key& key) const
+{
+    const auto iter = entitiesByKey_.find(key);
+    if (iter == entitiesByKey_.end())
+        return {};
+    return {iter->second.data(), static_cast<eastl_size_t>(iter->second.size())};
+}
+
+template <class T, class Key, class Map>
+const Key* EntityValueIndex<T, Key, Map>::GetKey(entt::entity entity) const
+{
+    return keys_.contains(entity) ? &keys_.get(entity).key_ : nullptr;
+}
+
+template <class T, class Key, class Map>
+void EntityValueIndex<T, Key, Map>::AddEntity(entt::entity entity, const Key& key)
+{
+    ea::vector<entt::entity>& entities = entitiesByKey_[key];
+    keys_.emplace(entity, EntityKey{key, static_cast<unsigned>(entities.size())});
+    entities.push_back(entity);
+}
+
+template <class T, class Key, class Map> void EntityValueIndex<T, Key, Map>::RemoveEntity(entt::entity entity)
+{
+    if (!keys_.contains(entity))
+        return;
+
+    const EntityKey entityKey = keys_.get(entity);
+    const auto iter = entitiesByKey_.find(entityKey.key_);
+    URHO3D_ASSERT(iter != entitiesByKey_.end());
+
+    // Move the last entity into the vacant position.
+    ea::vector<entt::entity>& entities = iter->second;
+    const entt::entity lastEntity = entities.back();
+    entities[entityKey.position_] = lastEntity;
+    keys_.get(lastEntity).position_ = entityKey.position_;
+    entities.pop_back();
+
+    if (entities.empty())
+        entitiesByKey_.erase(iter);
+    keys_.erase(entity);
+}
+
+template <class T, class Key, class Map>
+void EntityValueIndex<T, Key, Map>::OnConstruct(entt::registry& registry, entt::entity entity)
+{
+    AddEntity(entity, projection_(registry.get<T>(entity)));
+}
+
+template <class T, class Key, class Map>
+void EntityValueIndex<T, Key, Map>::OnUpdate(entt::registry& registry, entt::entity entity)
+{
+    Key key = projection_(registry.get<T>(entity));
+    if (const Key* oldKey = GetKey(entity); oldKey && *oldKey == key)
+        return;
+
+    RemoveEntity(entity);
+    AddEntity(entity, key);
+}
+
+template <class T, class Key, class Map>
+void EntityValueIndex<T, Key, Map>::OnDestroy(entt::registry& registry, entt::entity entity)
+{
+    RemoveEntity(entity);
+}
+
+template <class T, class Key>
+ea::span<const entt::entity> EntityOrderedIndex<T, Key>::FindRange(const Key& minKey, const Key& maxKey)
+{
+    rangeResult_.clear();
+    if (maxKey < minKey)
+        return {};
+
+    const auto begin = this->entitiesByKey_.lower_bound(minKey);
+    const auto end = this->entitiesByKey_.upper_bound(maxKey);
+    for (auto iter = begin; iter != end; ++iter)
+        rangeResult_.insert(rangeResult_.end(), iter->second.begin(), iter->second.end());
+
+    return {rangeResult_.data(), static_cast<eastl_size_t>(rangeResult_.size())};
+}
+
+} // namespace Urho3D
@@ -0,0 +1,207 @@
+#pragma once
+
+#include "EntityManager.h"
+
+namespace Urho3D
+{
+
+/// Factory for logical component split into frequently accessed Hot part and rarely accessed Cold part.
+/// Parts are stored in separate EnTT storages so that views over Hot don't drag Cold data through cache.
+/// In the registry of EntityManager, Cold part is created and destroyed together with Hot part,
+/// including direct registry operations. Other registries may lack Cold part, default value is used then.
+/// Both parts are serialized into the same block with the version of Hot part and inspected together.
+template <class Hot, class Cold> class HotColdEntityComponentFactory : public DefaultEntityComponentFactory<Hot>
+{
+public:
+    static_assert(!std::is_empty_v<Hot> && !std::is_empty_v<Cold>, "Hot and cold parts should not be empty");
+    static_assert(Hot::Version == Cold::Version, "Hot and cold parts should have the same version");
+
+    explicit HotColdEntityComponentFactory(const ea::string& name);
+
+    /// Implement EntityComponentFactory.
+    /// @{
+    void Initialize(entt::registry& registry) override;
+    void SerializeComponent(Archive& archive, entt::registry& registry, entt::entity entity, unsigned version) override;
+    void SerializeComponents(Archive& archive, entt::registry& registry, unsigned version) override;
+    bool RenderUI(entt::registry& registry, entt::entity entity) override;
+    void CommitActions(entt::registry& registry) override;
+    bool ConnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query) override;
+    void DisconnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query) override;
+    void SerializeSnapshot(Archive& archive, entt::registry& registry) override;
+    void MergeComponents(entt::registry& registry, entt::registry& sourceRegistry, const EntityRemap& remap) override;
+    void CloneComponent(entt::registry& registry, entt::entity entity, ea::span<const entt::entity> clones) override;
+    /// @}
+
+private:
+    void OnHotConstructed(entt::registry& registry, entt::entity entity);
+    void OnHotDestroyed(entt::registry& registry, entt::entity entity);
+
+    /// Factory of Cold part. It is not registered in EntityManager and is used only for delegation.
+    DefaultEntityComponentFactory<Cold> coldFactory_;
+};
+
+template <class Hot, class Cold> void EntityManager::AddHotColdComponentType(const ea::string& name)
+{
+    AddComponentType(ea::make_unique<HotColdEntityComponentFactory<Hot, Cold>>(name));
+}
+
+template <class Hot, class Cold>
+HotColdEntityComponentFactory<Hot, Cold>::HotColdEntityComponentFactory(const ea::string& name)
+    : DefaultEntityComponentFactory<Hot>(name)
+    , coldFactory_(name)
+{
+}
+
+template <class Hot, class Cold> void HotColdEntityComponentFactory<Hot, Cold>::Initialize(entt::registry& registry)
+{
+    registry.on_construct<Hot>().template connect<&HotColdEntityComponentFactory::OnHotConstructed>(*this);
+    registry.on_destroy<Hot>().template connect<&HotColdEntityComponentFactory::OnHotDestroyed>(*this);
+
+    for (const entt::entity entity : registry.view<Hot>(entt::exclude<Cold>))
+        registry.emplace<Cold>(entity);
+}
+
+template <class Hot, class Cold>
+void HotColdEntityComponentFactory<Hot, Cold>::OnHotConstructed(entt::registry& registry, entt::entity entity)
+{
+    // Cold part may be already added if it was loaded or copied first.
+    if (!registry.all_of<Cold>(entity))
+        registry.emplace<Cold>(entity);
+}
+
+template <class Hot, class Cold>
+void HotColdEntityComponentFactory<Hot, Cold>::OnHotDestroyed(entt::registry& registry, entt::entity entity)
+{
+    registry.remove<Cold>(entity);
+}
+
+template <class Hot, class Cold>
+void HotColdEntityComponentFactory<Hot, Cold>::SerializeComponent(
+    Archive& archive, entt::registry& registry, entt::entity entity, unsigned version)
+{
+    DefaultEntityComponentFactory<Hot>::SerializeComponent(archive, registry, entity, version);
+    if (registry.all_of<Cold>(entity))
+    {
+        coldFactory_.SerializeComponent(archive, registry, entity, version);
+        return;
+    }
+
+    Cold cold{};
+    cold.SerializeInBlock(archive, version);
+    if (archive.IsInput())
+        registry.emplace<Cold>(entity, ea::move(cold));
+}
+
+template <class Hot, class Cold>
+void HotColdEntityComponentFactory<Hot, Cold>::SerializeComponents(
+    Archive& archive, entt::registry& registry, unsigned version)
+{
+    if (archive.IsInput())
+    {
+        const auto block = archive.OpenArrayBlock("components", 0);
+        for (unsigned i = 0; i < block.GetSizeHint(); ++i)
+        {
+            const auto elementBlock = archive.OpenUnorderedBlock("component");
+
+            unsigned entityData = 0;
+            archive.Serialize("_entity", entityData);
+            const auto entity = static_cast<entt::entity>(entityData);
+
+            Hot hot{};
+            hot.SerializeInBlock(archive, version);
+            Cold cold{};
+            cold.SerializeInBlock(archive, version);
+
+            // Cold part goes first so that construction listeners of Hot part observe complete component.
+            registry.emplace_or_replace<Cold>(entity, ea::move(cold));
+            registry.emplace_or_replace<Hot>(entity, ea::move(hot));
+        }
+    }
+    else
+    {
+        static thread_local ea::vector<entt::entity> entitiesBuffer;
+        auto& entities = entitiesBuffer;
+
+        const auto isInherited = [&](entt::entity entity)
+        {
+            return EntityManager::IsComponentInherited<Hot>(registry, entity) && registry.all_of<Cold>(entity)
+                && EntityManager::IsComponentInherited<Cold>(registry, entity);
+        };
+        EntityManager::CollectSerializedEntities(entities, registry, registry.view<Hot>(), isInherited);
+
+        const auto block = archive.OpenArrayBlock("components", entities.size());
+        for (const entt::entity entity : entities)
+        {
+            const auto elementBlock = archive.OpenUnorderedBlock("component");
+
+            auto entityData = static_cast<unsigned>(entity);
+            archive.Serialize("_entity", entityData);
+
+            registry.get<Hot>(entity).SerializeInBlock(archive, version);
+            if (Cold* cold = registry.try_get<Cold>(entity))
+                cold->SerializeInBlock(archive, version);
+            else
+                Cold{}.SerializeInBlock(archive, version);
+        }
+    }
+}
+
+template <class Hot, class Cold>
+bool HotColdEntityComponentFactory<Hot, Cold>::RenderUI(entt::registry& registry, entt::entity entity)
+{
+    const bool hotChanged = DefaultEntityComponentFactory<Hot>::RenderUI(registry, entity);
+    const bool coldChanged = coldFactory_.RenderUI(registry, entity);
+    return hotChanged || coldChanged;
+}
+
+template <class Hot, class Cold> void HotColdEntityComponentFactory<Hot, Cold>::CommitActions(entt::registry& registry)
+{
+    DefaultEntityComponentFactory<Hot>::CommitActions(registry);
+    coldFactory_.CommitActions(registry);
+}
+
+template <class Hot, class Cold>
+bool HotColdEntityComponentFactory<Hot, Cold>::ConnectReactiveQuery(
+    entt::registry& registry, EntityReactiveQuery& query)
+{
+    DefaultEntityComponentFactory<Hot>::ConnectReactiveQuery(registry, query);
+
+    // Update of either part is an update of the logical component.
+    if (query.IsTriggeredOnUpdated())
+        registry.on_update<Cold>().template connect<&EntityReactiveQuery::OnTriggered>(query);
+    return true;
+}
+
+template <class Hot, class Cold>
+void HotColdEntityComponentFactory<Hot, Cold>::DisconnectReactiveQuery(
+    entt::registry& registry, EntityReactiveQuery& query)
+{
+    DefaultEntityComponentFactory<Hot>::DisconnectReactiveQuery(registry, query);
+    registry.on_update<Cold>().disconnect(&query);
+}
+
+template <class Hot, class Cold>
+void HotColdEntityComponentFactory<Hot, Cold>::SerializeSnapshot(Archive& archive, entt::registry& registry)
+{
+    // Restored Hot storage adds and removes Cold parts, so Cold storage is restored after it.
+    DefaultEntityComponentFactory<Hot>::SerializeSnapshot(archive, registry);
+    coldFactory_.SerializeSnapshot(archive, registry);
+}
+
+template <class Hot, class Cold>
+void HotColdEntityComponentFactory<Hot, Cold>::MergeComponents(
+    entt::registry& registry, entt::registry& sourceRegistry, const EntityRemap& remap)
+{
+    coldFactory_.MergeComponents(registry, sourceRegistry, remap);
+    DefaultEntityComponentFactory<Hot>::MergeComponents(registry, sourceRegistry, remap);
+}
+
+template <class Hot, class Cold>
+void HotColdEntityComponentFactory<Hot, Cold>::CloneComponent(
+    entt::registry& registry, entt::entity entity, ea::span<const entt::entity> clones)
+{
+    coldFactory_.CloneComponent(registry, entity, clones);
+    DefaultEntityComponentFactory<Hot>::CloneComponent(registry, entity, clones);
+}
+
+} // namespace Urho3D
@@ -0,0 +1,337 @@
+#pragma once
+
+#include "EntityManager.h"
+
+#include <Urho3D/Container/RefCounted.h>
+
+#include <EASTL/unordered_map.h>
+
+#include <cstring>
+#include <mutex>
+
+namespace Urho3D
+{
+
+/// Immutable value shared between entities.
+template <class T> class SharedEntityComponentValue : public RefCounted
+{
+public:
+    explicit SharedEntityComponentValue(const T& value)
+        : value_(value)
+    {
+    }
+
+    const T& Get() const { return value_; }
+
+private:
+    const T value_;
+};
+
+/// Return whether T has Urho3D-style hash function.
+template <class T, class = void> struct IsEntityComponentHashable : std::false_type
+{
+};
+
+template <class T>
+struct IsEntityComponentHashable<T, std::void_t<decltype(static_cast<unsigned>(std::declval<const T&>().ToHash()))>>
+    : std::true_type
+{
+};
+
+/// Process-wide pool of unique shared values of type T.
+/// Values are deduplicated via operator== and released when the last entity stops referencing them.
+/// T should either have ToHash() or have unique object representation so that its bytes can be hashed.
+/// Pool is split into shards by hash, each shard is locked separately.
+template <class T> class SharedEntityComponentPool
+{
+public:
+    static SharedPtr<SharedEntityComponentValue<T>> Acquire(const T& value);
+    static unsigned GetNumValues();
+
+private:
+    static constexpr unsigned NumShards = 16;
+
+    struct Shard
+    {
+        std::mutex mutex_;
+        /// Values with the same hash. Released values are pruned when the bucket is visited.
+        ea::unordered_map<unsigned, ea::vector<WeakPtr<SharedEntityComponentValue<T>>>> buckets_;
+        /// Number of buckets that triggers pruning of all buckets in the shard.
+        unsigned pruneThreshold_{MinPruneThreshold};
+    };
+
+    static constexpr unsigned MinPruneThreshold = 64;
+
+    /// Remove released values and empty buckets. Threshold doubles relative to remaining buckets.
+    static void PruneShard(Shard& shard);
+
+    static SharedEntityComponentPool& GetInstance();
+    static unsigned GetHash(const T& value);
+
+    Shard shards_[NumShards];
+};
+
+/// Component that references deduplicated value shared by many entities.
+/// Value is immutable, use Set to make entity reference another value.
+/// Default value of T is always represented by null and doesn't touch the pool,
+/// so components with equal values always reference the same shared value.
+template <class T> class SharedEntityComponent
+{
+public:
+    static constexpr unsigned Version = T::Version;
+
+    SharedEntityComponent() = default;
+    explicit SharedEntityComponent(const T& value) { Set(value); }
+
+    const T& Get() const;
+    void Set(const T& value);
+    /// Return identity of shared value. Equal values have equal identities.
+    const void* GetIdentity() const { return value_.Get(); }
+
+    bool operator==(const SharedEntityComponent<T>& rhs) const { return value_ == rhs.value_; }
+    bool operator!=(const SharedEntityComponent<T>& rhs) const { return value_ != rhs.value_; }
+
+    /// Implement DefaultEntityComponentFactory requirements.
+    /// @{
+    void SerializeInBlock(Archive& archive, unsigned version);
+    bool RenderInspector();
+    /// @}
+
+private:
+    static const T& GetDefaultValue();
+
+    SharedPtr<SharedEntityComponentValue<T>> value_;
+};
+
+/// Component factory for SharedEntityComponent<T>.
+/// Each unique value is serialized once, entities store only value indices.
+template <class T>
+class SharedEntityComponentFactory : public DefaultEntityComponentFactory<SharedEntityComponent<T>>
+{
+public:
+    using DefaultEntityComponentFactory<SharedEntityComponent<T>>::DefaultEntityComponentFactory;
+
+    /// Implement EntityComponentFactory.
+    /// @{
+    void SerializeComponents(Archive& archive, entt::registry& registry, unsigned version) override;
+    /// @}
+};
+
+template <class T> void EntityManager::AddSharedComponentType(const ea::string& name)
+{
+    AddComponentType(ea::make_unique<SharedEntityComponentFactory<T>>(name));
+}
+
+template <class T> SharedEntityComponentPool<T>& SharedEntityComponentPool<T>::GetInstance()
+{
+    static SharedEntityComponentPool<T> instance;
+    return instance;
+}
+
+template <class T> unsigned SharedEntityComponentPool<T>::GetHash(const T& value)
+{
+    if constexpr (IsEntityComponentHashable<T>::value)
+        return static_cast<unsigned>(value.ToHash());
+    else
+    {
+        static_assert(std::has_unique_object_representations_v<T>,
+            "Shared component value should have ToHash() or unique object representation");
+
+        // FNV-1a over object bytes.
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        unsigned hash = 2166136261u;
+        for (const unsigned char byte : bytes)
+            hash = (hash ^ byte) * 16777619u;
+        return hash;
+    }
+}
+
+template <class T>
+SharedPtr<SharedEntityComponentValue<T>> SharedEntityComponentPool<T>::Acquire(const T& value)
+{
+    static_assert(IsEntityComponentComparable<T>::value, "Shared component value should support operator==");
+
+    const unsigned hash = GetHash(value);
+    Shard& shard = GetInstance().shards_[hash % NumShards];
+    std::lock_guard<std::mutex> lock(shard.mutex_);
+
+    if (shard.buckets_.size() >= shard.pruneThreshold_)
+        PruneShard(shard);
+
+    auto& bucket = shard.buckets_[hash];
+    for (unsigned i = 0; i < bucket.size();)
+    {
+        // Drop released values with the same hash while searching.
+        SharedPtr<SharedEntityComponentValue<T>> existingValue = bucket[i].Lock();
+        if (!existingValue)
+        {
+            bucket.erase_unsorted(bucket.begin() + i);
+            continue;
+        }
+
+        if (existingValue->Get() == value)
+            return existingValue;
+        ++i;
+    }
+
+    auto result = MakeShared<SharedEntityComponentValue<T>>(value);
+    bucket.emplace_back(result);
+    return result;
+}
+
+template <class T> void SharedEntityComponentPool<T>::PruneShard(Shard& shard)
+{
+    for (auto iter = shard.buckets_.begin(); iter != shard.buckets_.end();)
+    {
+        auto& bucket = iter->second;
+        bucket.erase(ea::remove_if(bucket.begin(), bucket.end(), [](const auto& value) { return value.Expired(); }),
+            bucket.end());
+
+        if (bucket.empty())
+            iter = shard.buckets_.erase(iter);
+        else
+            ++iter;
+    }
+
+    shard.pruneThreshold_ = ea::max(MinPruneThreshold, 2 * static_cast<unsigned>(shard.buckets_.size()));
+}
+
+template <class T> unsigned SharedEntityComponentPool<T>::GetNumValues()
+{
+    unsigned result = 0;
+    for (Shard& shard : GetInstance().shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        for (const auto& [hash, bucket] : shard.buckets_)
+        {
+            result += static_cast<unsigned>(
+                ea::count_if(bucket.begin(), bucket.end(), [](const auto& value) { return !value.Expired(); }));
+        }
+    }
+    return result;
+}
+
+template <class T> const T& SharedEntityComponent<T>::GetDefaultValue()
+{
+    static const T defaultValue{};
+    return defaultValue;
+}
+
+template <class T> const T& SharedEntityComponent<T>::Get() const
+{
+    return value_ ? value_->Get() : GetDefaultValue();
+}
+
+template <class T> void SharedEntityComponent<T>::Set(const T& value)
+{
+    if (value == GetDefaultValue())
+        value_ = nullptr;
+    else
+        value_ = SharedEntityComponentPool<T>::Acquire(value);
+}
+
+template <class T> void SharedEntityComponent<T>::SerializeInBlock(Archive& archive, unsigned version)
+{
+    T value = Get();
+    value.SerializeInBlock(archive, version);
+    if (archive.IsInput())
+        Set(value);
+}
+
+template <class T> bool SharedEntityComponent<T>::RenderInspector()
+{
+    T value = Get();
+    if (!value.RenderInspector())
+        return false;
+
+    Set(value);
+    return true;
+}
+
+template <class T>
+void SharedEntityComponentFactory<T>::SerializeComponents(Archive& archive, entt::registry& registry, unsigned version)
+{
+    using ComponentType = SharedEntityComponent<T>;
+
+    static thread_local ea::vector<ComponentType> valuesBuffer;
+    auto& values = valuesBuffer;
+
+    if (archive.IsInput())
+    {
+        values.clear();
+        {
+            const auto valuesBlock = archive.OpenArrayBlock("values", 0);
+            for (unsigned i = 0; i < valuesBlock.GetSizeHint(); ++i)
+            {
+                const auto valueBlock = archive.OpenUnorderedBlock("value");
+                values.emplace_back();
+                values.back().SerializeInBlock(archive, version);
+            }
+        }
+
+        const auto block = archive.OpenArrayBlock("components", 0);
+        for (unsigned i = 0; i < block.GetSizeHint(); ++i)
+        {
+            const auto elementBlock = archive.OpenUnorderedBlock("component");
+
+            unsigned entityData = 0;
+            archive.Serialize("_entity", entityData);
+            unsigned valueIndex = 0;
+            archive.SerializeVLE("value", valueIndex);
+
+            if (valueIndex >= values.size())
+                throw ArchiveException("Invalid shared value #{} of entity {}", valueIndex, entityData);
+
+            registry.emplace_or_replace<ComponentType>(static_cast<entt::entity>(entityData), values[valueIndex]);
+        }
+        values.clear();
+    }
+    else
+    {
+        static thread_local ea::vector<ea::pair<entt::entity, unsigned>> entitiesBuffer;
+        auto& entities = entitiesBuffer;
+        static thread_local ea::unordered_map<const void*, unsigned> valueIndicesBuffer;
+        auto& valueIndices = valueIndicesBuffer;
+
+        values.clear();
+        entities.clear();
+        valueIndices.clear();
+        for (const auto& [entity, component] : registry.storage<ComponentType>().each())
+        {
+            if (EntityManager::IsComponentInherited<ComponentType>(registry, entity))
+                continue;
+
+            const auto [iter, inserted] = valueIndices.emplace(component.GetIdentity(), values.size());
+            if (inserted)
+                values.push_back(component);
+            entities.emplace_back(entity, iter->second);
+        }
+        ea::sort(entities.begin(), entities.end(), [](const auto& lhs, const auto& rhs)
+            { return EntityManager::GetEntityIndex(lhs.first) < EntityManager::GetEntityIndex(rhs.first); });
+
+        {
+            const auto valuesBlock = archive.OpenArrayBlock("values", values.size());
+            for (ComponentType& value : values)
+            {
+                const auto valueBlock = archive.OpenUnorderedBlock("value");
+                value.SerializeInBlock(archive, version);
+            }
+        }
+
+        const auto block = archive.OpenArrayBlock("components", entities.size());
+        for (auto& [entity, valueIndex] : entities)
+        {
+            const auto elementBlock = archive.OpenUnorderedBlock("component");
+
+            auto entityData = static_cast<unsigned>(entity);
+            archive.Serialize("_entity", entityData);
+            archive.SerializeVLE("value", valueIndex);
+        }
+
+        values.clear();
+        valueIndices.clear();
+    }
+}
+
+} // namespace Urho3D
@@ -0,0 +1,403 @@
+#pragma once
+
+#include "EntityAlignedStorage.h"
+
+#include <EASTL/array.h>
+
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+namespace Urho3D
+{
+
+/// Tag component that marks entities with component T stored as structure of arrays.
+template <class T> struct EntitySoA
+{
+    static constexpr unsigned Version = T::Version;
+};
+
+/// Columns of component T stored as structure of arrays, one column per float field.
+/// T should consist only of float fields listed in static constexpr array T::SoAFields of member pointers.
+/// Columns are stored in registry context. In the registry of EntityManager they are kept in sync with EntitySoA<T>
+/// tags via signals. In other registries rows are created when the factory sets values, missing rows read as default.
+/// Rows are independent of tag storage order, so tag storage may be sorted.
+/// Each column starts at ColumnAlignment-byte aligned address, so columns can be processed with aligned SIMD loads.
+/// Values changed via Set or columns are not observed by listeners, use registry.patch<EntitySoA<T>> to notify them.
+template <class T> class EntitySoAColumns
+{
+public:
+    static constexpr unsigned NumFields = static_cast<unsigned>(std::size(T::SoAFields));
+    static constexpr unsigned ColumnAlignment = 64;
+    static_assert(sizeof(T) == NumFields * sizeof(float), "All fields of SoA component should be listed in SoAFields");
+
+    /// Proxy access to individual components.
+    /// @{
+    bool Contains(entt::entity entity) const { return rows_.contains(entity); }
+    T Get(entt::entity entity) const;
+    void Set(entt::entity entity, const T& value);
+    /// @}
+
+    /// Bulk access to columns. Row i of each column belongs to entity i of GetEntities.
+    /// Spans are invalidated when components are added or removed.
+    /// @{
+    ea::span<const entt::entity> GetEntities() const;
+    ea::span<float> GetColumn(unsigned fieldIndex);
+    ea::span<const float> GetColumn(unsigned fieldIndex) const;
+    /// @}
+
+    /// Called by SoAEntityComponentFactory. Don't call it manually.
+    /// @{
+    void AddEntity(entt::entity entity, const T& value);
+    void RemoveEntity(entt::entity entity);
+    /// @}
+
+private:
+    using Column = std::vector<float, EntityAlignedAllocator<float, ColumnAlignment>>;
+
+    entt::sparse_set rows_;
+    ea::array<Column, NumFields> columns_;
+};
+
+/// Factory for component T stored as structure of arrays.
+/// Component is serialized and inspected as regular T assembled from columns.
+template <class T> class SoAEntityComponentFactory : public DefaultEntityComponentFactory<EntitySoA<T>>
+{
+public:
+    using TagType = EntitySoA<T>;
+    using DefaultEntityComponentFactory<TagType>::DefaultEntityComponentFactory;
+
+    /// Return columns of the registry, columns are created if missing.
+    static EntitySoAColumns<T>& GetColumns(entt::registry& registry);
+    /// Return value of the component or default value if the entity has no row.
+    static T GetComponent(entt::registry& registry, entt::entity entity);
+
+    /// Implement EntityComponentFactory.
+    /// @{
+    void Initialize(entt::registry& registry) override;
+    bool IsEmpty() const override { return false; }
+    void SerializeComponent(Archive& archive, entt::registry& registry, entt::entity entity, unsigned version) override;
+    void SerializeComponents(Archive& archive, entt::registry& registry, unsigned version) override;
+    bool RenderUI(entt::registry& registry, entt::entity entity) override;
+    void CommitActions(entt::registry& registry) override;
+    void SerializeSnapshot(Archive& archive, entt::registry& registry) override;
+    void MergeComponents(entt::registry& registry, entt::registry& sourceRegistry, const EntityRemap& remap) override;
+    void CloneComponent(entt::registry& registry, entt::entity entity, ea::span<const entt::entity> clones) override;
+    /// @}
+
+private:
+    static void SetComponent(entt::registry& registry, entt::entity entity, const T& value);
+    static bool IsInherited(entt::registry& registry, entt::entity entity);
+
+    void OnConstruct(entt::registry& registry, entt::entity entity);
+    void OnDestroy(entt::registry& registry, entt::entity entity);
+
+    ea::vector<ea::pair<entt::entity, T>> pendingEditActions_;
+};
+
+template <class T> void EntityManager::AddSoAComponentType(const ea::string& name)
+{
+    AddComponentType(ea::make_unique<SoAEntityComponentFactory<T>>(name));
+}
+
+template <class T> T EntitySoAColumns<T>::Get(entt::entity entity) const
+{
+    T value{};
+    const auto row = static_cast<unsigned>(rows_.index(entity));
+    for (unsigned i = 0; i < NumFields; ++i)
+        value.*(T::SoAFields[i]) = columns_[i][row];
+    return value;
+}
+
+template <class T> void EntitySoAColumns<T>::Set(entt::entity entity, const T& value)
+{
+    const auto row = static_cast<unsigned>(rows_.index(entity));
+    for (unsigned i = 0; i < NumFields; ++i)
+        columns_[i][row] = value.*(T::SoAFields[i]);
+}
+
+template <class T> ea::span<const entt::entity> EntitySoAColumns<T>::GetEntities() const
+{
+    return {rows_.data(), static_cast<eastl_size_t>(rows_.size())};
+}
+
+template <class T> ea::span<float> EntitySoAColumns<T>::GetColumn(unsigned fieldIndex)
+{
+    Column& column = columns_[fieldIndex];
+    return {column.data(), static_cast<eastl_size_t>(column.size())};
+}
+
+template <class T> ea::span<const float> EntitySoAColumns<T>::GetColumn(unsigned fieldIndex) const
+{
+    const Column& column = columns_[fieldIndex];
+    return {column.data(), static_cast<eastl_size_t>(column.size())};
+}
+
+template <class T> void EntitySoAColumns<T>::AddEntity(entt::entity entity, const T& value)
+{
+    rows_.push(entity);
+    for (unsigned i = 0; i < NumFields; ++i)
+        columns_[i].push_back(value.*(T::SoAFields[i]));
+}
+
+template <class T> void EntitySoAColumns<T>::RemoveEntity(entt::entity entity)
+{
+    if (!rows_.contains(entity))
+        return;
+
+    // Mirror swap-and-pop of the sparse set.
+    const auto row = static_cast<unsigned>(rows_.index(entity));
+    for (Column& column : columns_)
+    {
+        column[row] = column.back();
+        column.pop_back();
+    }
+    rows_.erase(entity);
+}
+
+template <class T> EntitySoAColumns<T>& SoAEntityComponentFactory<T>::GetColumns(entt::registry& registry)
+{
+    return registry.ctx().template emplace<EntitySoAColumns<T>>();
+}
+
+template <class T> T SoAEntityComponentFactory<T>::GetComponent(entt::registry& registry, entt::entity entity)
+{
+    const EntitySoAColumns<T>& columns = GetColumns(registry);
+    return columns.Contains(entity) ? columns.Get(entity) : T{};
+}
+
+template <class T> void SoAEntityComponentFactory<T>::Initialize(entt::registry& registry)
+{
+    registry.on_construct<TagType>().template connect<&SoAEntityComponentFactory<T>::OnConstruct>(*this);
+    registry.on_destroy<TagType>().template connect<&SoAEntityComponentFactory<T>::OnDestroy>(*this);
+
+    EntitySoAColumns<T>& columns = GetColumns(registry);
+    for (const entt::entity entity : registry.view<TagType>())
+    {
+        if (!columns.Contains(entity))
+            columns.AddEntity(entity, T{});
+    }
+}
+
+template <class T> void SoAEntityComponentFactory<T>::OnConstruct(entt::registry& registry, entt::entity entity)
+{
+    GetColumns(registry).AddEntity(entity, T{});
+}
+
+template <class T> void SoAEntityComponentFactory<T>::OnDestroy(entt::registry& registry, entt::entity entity)
+{
+    GetColumns(registry).RemoveEntity(entity);
+}
+
+template <class T>
+void SoAEntityComponentFactory<T>::SetComponent(entt::registry& registry, entt::entity entity, const T& value)
+{
+    if (!registry.all_of<TagType>(entity))
+        registry.emplace<TagType>(entity);
+
+    // Rows are added by signals only in the registry of EntityManager.
+    EntitySoAColumns<T>& columns = GetColumns(registry);
+    if (columns.Contains(entity))
+        columns.Set(entity, value);
+    else
+        columns.AddEntity(entity, value);
+    registry.patch<TagType>(entity);
+}
+
+template <class T> bool SoAEntityComponentFactory<T>::IsInherited(entt::registry& registry, entt::entity entity)
+{
+    const entt::entity templateEntity = EntityManager::FindValidTemplate(registry, entity);
+    if (templateEntity == entt::null || !registry.all_of<TagType>(templateEntity))
+        return false;
+
+    const T value = GetComponent(registry, entity);
+    const T templateValue = GetComponent(registry, templateEntity);
+    for (unsigned i = 0; i < EntitySoAColumns<T>::NumFields; ++i)
+    {
+        if (value.*(T::SoAFields[i]) != templateValue.*(T::SoAFields[i]))
+            return false;
+    }
+    return true;
+}
+
+template <class T>
+void SoAEntityComponentFactory<T>::SerializeComponent(
+    Archive& archive, entt::registry& registry, entt::entity entity, unsigned version)
+{
+    T value = GetComponent(registry, entity);
+    value.SerializeInBlock(archive, version);
+    if (archive.IsInput())
+        SetComponent(registry, entity, value);
+}
+
+template <class T>
+void SoAEntityComponentFactory<T>::SerializeComponents(Archive& archive, entt::registry& registry, unsigned version)
+{
+    if (archive.IsInput())
+    {
+        const auto block = archive.OpenArrayBlock("components", 0);
+        for (unsigned i = 0; i < block.GetSizeHint(); ++i)
+        {
+            const auto elementBlock = archive.OpenUnorderedBlock("component");
+
+            unsigned entityData = 0;
+            archive.Serialize("_entity", entityData);
+
+            T value{};
+            value.SerializeInBlock(archive, version);
+            SetComponent(registry, static_cast<entt::entity>(entityData), value);
+        }
+    }
+    else
+    {
+        static thread_local ea::vector<entt::entity> entitiesBuffer;
+        auto& entities = entitiesBuffer;
+
+        EntityManager::CollectSerializedEntities(entities, registry, registry.view<TagType>(),
+            [&](entt::entity entity) { return IsInherited(registry, entity); });
+
+        const auto block = archive.OpenArrayBlock("components", entities.size());
+        for (const entt::entity entity : entities)
+        {
+            const auto elementBlock = archive.OpenUnorderedBlock("component");
+
+            auto entityData = static_cast<unsigned>(entity);
+            archive.Serialize("_entity", entityData);
+
+            T value = GetComponent(registry, entity);
+            value.SerializeInBlock(archive, version);
+        }
+    }
+}
+
+template <class T> bool SoAEntityComponentFactory<T>::RenderUI(entt::registry& registry, entt::entity entity)
+{
+    T value = GetComponent(registry, entity);
+    if (!value.RenderInspector())
+        return false;
+
+    pendingEditActions_.emplace_back(entity, value);
+    return true;
+}
+
+template <class T> void SoAEntityComponentFactory<T>::CommitActions(entt::registry& registry)
+{
+    for (const auto& [entity, value] : pendingEditActions_)
+    {
+        if (!registry.valid(entity) || !registry.all_of<TagType>(entity))
+        {
+            URHO3D_LOGERROR("Cannot edit component '{}' in entity {}", this->GetName(), entity);
+            continue;
+        }
+
+        SetComponent(registry, entity, value);
+    }
+    pendingEditActions_.clear();
+}
+
+template <class T> void SoAEntityComponentFactory<T>::SerializeSnapshot(Archive& archive, entt::registry& registry)
+{
+    constexpr unsigned numFields = EntitySoAColumns<T>::NumFields;
+    EntitySoAColumns<T>& columns = GetColumns(registry);
+
+    static thread_local ea::vector<entt::entity> entitiesBuffer;
+    auto& entities = entitiesBuffer;
+    static thread_local ea::vector<float> valuesBuffer;
+    auto& values = valuesBuffer;
+
+    auto numComponents = static_cast<unsigned>(columns.GetEntities().size());
+    archive.SerializeVLE("size", numComponents);
+
+    if (!archive.IsInput())
+    {
+        const ea::span<const entt::entity> rows = columns.GetEntities();
+        entities.assign(rows.begin(), rows.end());
+        archive.SerializeBytes("entities", entities.data(), numComponents * sizeof(entt::entity));
+
+        values.clear();
+        for (unsigned i = 0; i < numFields; ++i)
+        {
+            const ea::span<const float> column = columns.GetColumn(i);
+            values.insert(values.end(), column.begin(), column.end());
+        }
+        archive.SerializeBytes("values", values.data(), numComponents * numFields * sizeof(float));
+        return;
+    }
+
+    entities.resize(numComponents);
+    archive.SerializeBytes("entities", entities.data(), numComponents * sizeof(entt::entity));
+    values.resize(numComponents * numFields);
+    archive.SerializeBytes("values", values.data(), numComponents * numFields * sizeof(float));
+
+    // Remove components that are not in the snapshot. Rows are removed from the end to keep indices valid.
+    static thread_local entt::sparse_set entitiesSetBuffer;
+    auto& entitiesSet = entitiesSetBuffer;
+    entitiesSet.clear();
+    entitiesSet.push(entities.begin(), entities.end());
+
+    const ea::span<const entt::entity> rows = columns.GetEntities();
+    for (unsigned row = static_cast<unsigned>(rows.size()); row > 0; --row)
+    {
+        const entt::entity entity = rows[row - 1];
+        if (!entitiesSet.contains(entity))
+            registry.remove<TagType>(entity);
+    }
+    entitiesSet.clear();
+
+    // Add missing components and replace changed values.
+    for (unsigned i = 0; i < numComponents; ++i)
+    {
+        const entt::entity entity = entities[i];
+
+        T value{};
+        for (unsigned j = 0; j < numFields; ++j)
+            value.*(T::SoAFields[j]) = values[j * numComponents + i];
+
+        if (columns.Contains(entity))
+        {
+            const T oldValue = columns.Get(entity);
+            if (std::memcmp(&value, &oldValue, sizeof(T)) == 0)
+                continue;
+        }
+        SetComponent(registry, entity, value);
+    }
+}
+
+template <class T>
+void SoAEntityComponentFactory<T>::MergeComponents(
+    entt::registry& registry, entt::registry& sourceRegistry, const EntityRemap& remap)
+{
+    const auto& sourceStorage = sourceRegistry.storage<TagType>();
+    const auto* sourceColumns = sourceRegistry.ctx().template find<EntitySoAColumns<T>>();
+
+    const ea::span<const entt::entity> sourceEntities{
+        sourceStorage.data(), static_cast<eastl_size_t>(sourceStorage.size())};
+    for (const entt::entity sourceEntity : sourceEntities)
+    {
+        const T value =
+            sourceColumns && sourceColumns->Contains(sourceEntity) ? sourceColumns->Get(sourceEntity) : T{};
+        SetComponent(registry, remap.Remap(sourceEntity), value);
+    }
+}
+
+template <class T>
+void SoAEntityComponentFactory<T>::CloneComponent(
+    entt::registry& registry, entt::entity entity, ea::span<const entt::entity> clones)
+{
+    if (!registry.all_of<TagType>(entity))
+        return;
+
+    const T value = GetComponent(registry, entity);
+    registry.insert<TagType>(clones.begin(), clones.end());
+
+    EntitySoAColumns<T>& columns = GetColumns(registry);
+    for (const entt::entity clone : clones)
+    {
+        if (columns.Contains(clone))
+            columns.Set(clone, value);
+        else
+            columns.AddEntity(clone, value);
+    }
+}
+
+} // namespace Urho3D
@@ -0,0 +1,112 @@
+#include "TagEntityComponent.h"
+
+namespace Urho3D
+{
+
+namespace
+{
+
+unsigned CountSetBits64(EntityBitset::Word word)
+{
+    return CountSetBits(static_cast<unsigned>(word)) + CountSetBits(static_cast<unsigned>(word >> 32));
+}
+
+} // namespace
+
+void EntityBitset::Set(unsigned index)
+{
+    const unsigned wordIndex = index / BitsPerWord;
+    if (wordIndex >= words_.size())
+        words_.resize(wordIndex + 1, 0);
+    words_[wordIndex] |= Word{1} << (index % BitsPerWord);
+}
+
+void EntityBitset::Reset(unsigned index)
+{
+    const unsigned wordIndex = index / BitsPerWord;
+    if (wordIndex < words_.size())
+        words_[wordIndex] &= ~(Word{1} << (index % BitsPerWord));
+}
+
+bool EntityBitset::Test(unsigned index) const
+{
+    const unsigned wordIndex = index / BitsPerWord;
+    return wordIndex < words_.size() && (words_[wordIndex] & (Word{1} << (index % BitsPerWord))) != 0;
+}
+
+unsigned EntityBitset::Count() const
+{
+    unsigned result = 0;
+    for (const Word word : words_)
+        result += CountSetBits64(word);
+    return result;
+}
+
+void EntityBitset::SerializeRanges(Archive& archive, const char* name)
+{
+    // Each range is stored as distance from the end of previous range and number of set bits.
+    if (archive.IsInput())
+    {
+        const unsigned maxIndex = entt::entt_traits<entt::entity>::entity_mask;
+
+        const auto block = archive.OpenArrayBlock(name, 0);
+        unsigned index = 0;
+        for (unsigned i = 0; i < block.GetSizeHint(); ++i)
+        {
+            const auto rangeBlock = archive.OpenUnorderedBlock("range");
+
+            unsigned skip = 0;
+            archive.SerializeVLE("skip", skip);
+            unsigned count = 0;
+            archive.SerializeVLE("count", count);
+
+            if (skip > maxIndex - index || count > maxIndex - index - skip)
+                throw ArchiveException("Invalid range of entity indices in '{}'", name);
+
+            index += skip;
+            for (unsigned j = 0; j < count; ++j, ++index)
+                Set(index);
+        }
+    }
+    else
+    {
+        static thread_local ea::vector<ea::pair<unsigned, unsigned>> rangesBuffer;
+        auto& ranges = rangesBuffer;
+
+        ranges.clear();
+        unsigned rangeEnd = 0;
+        ForEach(
+            [&](unsigned index)
+        {
+            if (!ranges.empty() && index == rangeEnd)
+                ++ranges.back().second;
+            else
+                ranges.emplace_back(index - rangeEnd, 1);
+            rangeEnd = index + 1;
+        });
+
+        const auto block = archive.OpenArrayBlock(name, ranges.size());
+        for (auto& [skip, count] : ranges)
+        {
+            const auto rangeBlock = archive.OpenUnorderedBlock("range");
+            archive.SerializeVLE("skip", skip);
+            archive.SerializeVLE("count", count);
+        }
+    }
+}
+
+void EntityBitset::SerializeWords(Archive& archive)
+{
+    auto numWords = static_cast<unsigned>(words_.size());
+    archive.SerializeVLE("numWords", numWords);
+    if (archive.IsInput())
+        words_.resize(numWords);
+    archive.SerializeBytes("words", words_.data(), numWords * sizeof(Word));
+}
+
+bool EntityBitset::IsEmpty() const
+{
+    return ea::all_of(words_.begin(), words_.end(), [](Word word) { return word == 0; });
+}
+
+} // namespace Urho3D
@@ -0,0 +1,442 @@
+#pragma once
+
+#include "EntityManager.h"
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+namespace Urho3D
+{
+
+/// Dense bitset indexed by entity index.
+class PLUGIN_CORE_ENTITYMANAGER_API EntityBitset
+{
+public:
+    using Word = unsigned long long;
+    static constexpr unsigned BitsPerWord = 64;
+
+    void Set(unsigned index);
+    void Reset(unsigned index);
+    bool Test(unsigned index) const;
+    void Clear() { words_.clear(); }
+
+    /// Return number of set bits.
+    unsigned Count() const;
+    bool IsEmpty() const;
+
+    /// Iterate indices of set bits in ascending order.
+    template <class Callback> void ForEach(const Callback& callback) const;
+    /// Iterate alive entities whose indices are set in ascending order.
+    template <class Callback> void ForEachEntity(const entt::registry& registry, const Callback& callback) const;
+
+    /// Save set bits or load and set bits as run-length encoded ranges of indices.
+    void SerializeRanges(Archive& archive, const char* name);
+    /// Save or restore raw words in same-process snapshot format.
+    void SerializeWords(Archive& archive);
+
+    const ea::vector<Word>& GetWords() const { return words_; }
+
+private:
+    static unsigned CountTrailingZeros(Word word);
+
+    ea::vector<Word> words_;
+};
+
+/// Version of run-length encoded ranges layout that is added to the version of tag component.
+/// Older data stores tagged entities in the layout of DefaultEntityComponentFactory.
+static constexpr unsigned EntityTagRangesVersion = 1u << 16;
+
+/// Factory for empty tag components that are stored in EnTT storage as usual.
+/// Tagged entities are serialized as run-length encoded ranges of entity indices instead of one block per entity.
+template <class T> class TagEntityComponentFactory : public DefaultEntityComponentFactory<T>
+{
+public:
+    static_assert(std::is_empty_v<T>, "Tag component should be empty");
+
+    static_assert(T::Version < EntityTagRangesVersion, "Tag component version is too big");
+
+    using DefaultEntityComponentFactory<T>::DefaultEntityComponentFactory;
+
+    /// Implement EntityComponentFactory.
+    /// @{
+    unsigned GetVersion() const override { return T::Version + EntityTagRangesVersion; }
+    void SerializeComponents(Archive& archive, entt::registry& registry, unsigned version) override;
+    /// @}
+};
+
+/// Disabled state of toggleable component T stored in registry context.
+/// Bits are indexed by entity index, so toggling doesn't touch any storage. Bits are reset when T is destroyed.
+template <class T> struct EntityDisabledComponents
+{
+    /// Set disabled state of the entity and notify listeners if it has changed.
+    void SetDisabled(entt::registry& registry, entt::entity entity, bool disabled);
+
+    EntityBitset bitset_;
+    /// Loaded state that is applied after template components are inherited.
+    EntityBitset pendingBitset_;
+
+    /// Signals used by reactive queries of disabled state.
+    /// @{
+    entt::sigh<void(entt::registry&, entt::entity)> onDisabled_;
+    entt::sigh<void(entt::registry&, entt::entity)> onEnabled_;
+    /// @}
+};
+
+/// Factory that exposes disabled state of toggleable component T as empty component.
+/// State is stored in EntityDisabledComponents<T>, the factory has no EnTT storage and doesn't support views.
+/// Reactive queries are triggered when the component is disabled and enabled again, there are no updates.
+/// Disabled entities are serialized in the same layout as tag components.
+template <class T> class DisabledEntityComponentFactory : public EntityComponentFactory
+{
+public:
+    using EntityComponentFactory::EntityComponentFactory;
+
+    /// Implement EntityComponentFactory.
+    /// @{
+    void Initialize(entt::registry& registry) override;
+    bool IsEmpty() const override { return true; }
+    unsigned GetVersion() const override { return 1; }
+    bool HasComponent(entt::registry& registry, entt::entity entity) override;
+    void CreateComponent(entt::registry& registry, entt::entity entity) override;
+    void DestroyComponent(entt::registry& registry, entt::entity entity) override;
+    void SerializeComponent(
+        Archive& archive, entt::registry& registry, entt::entity entity, unsigned version) override {}
+    void SerializeComponents(Archive& archive, entt::registry& registry, unsigned version) override;
+    void OnRegistryLoaded(entt::registry& registry) override;
+    bool RenderUI(entt::registry& registry, entt::entity entity) override { return false; }
+    void CommitActions(entt::registry& registry) override {}
+    bool ConnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query) override;
+    void DisconnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query) override;
+    bool IsSnapshotSupported() const override { return true; }
+    void SerializeSnapshot(Archive& archive, entt::registry& registry) override;
+    void MergeComponents(entt::registry& registry, entt::registry& sourceRegistry, const EntityRemap& remap) override;
+    void CloneComponent(entt::registry& registry, entt::entity entity, ea::span<const entt::entity> clones) override;
+    /// @}
+
+private:
+    static EntityDisabledComponents<T>& GetDisabledComponents(entt::registry& registry);
+    void OnComponentDestroyed(entt::registry& registry, entt::entity entity);
+};
+
+template <class T> void EntityManager::AddTagComponentType(const ea::string& name)
+{
+    AddComponentType(ea::make_unique<TagEntityComponentFactory<T>>(name));
+}
+
+template <class T> void EntityManager::AddToggleableComponentType(const ea::string& name)
+{
+    AddComponentType<T>(name);
+    AddComponentType(ea::make_unique<DisabledEntityComponentFactory<T>>(name + "Disabled"));
+}
+
+template <class T> void EntityManager::SetComponentEnabled(entt::entity entity, bool enabled)
+{
+    if (!IsEntityValid(entity) || !registry_.all_of<T>(entity))
+    {
+        URHO3D_LOGERROR("Cannot toggle missing component in entity {}", entity);
+        return;
+    }
+
+    auto disabledComponents = registry_.ctx().find<EntityDisabledComponents<T>>();
+    if (!disabledComponents)
+    {
+        URHO3D_LOGERROR("Cannot toggle component that is not registered as toggleable in entity {}", entity);
+        return;
+    }
+
+    disabledComponents->SetDisabled(registry_, entity, !enabled);
+}
+
+template <class T> bool EntityManager::IsComponentEnabled(entt::entity entity) const
+{
+    if (!registry_.all_of<T>(entity))
+        return false;
+
+    const auto disabledComponents = registry_.ctx().find<EntityDisabledComponents<T>>();
+    return !disabledComponents || !disabledComponents->bitset_.Test(GetEntityIndex(entity));
+}
+
+template <class... Components, class Callback> void EntityManager::ForEachEnabled(const Callback& callback)
+{
+    const EntityBitset* disabledBitsets[] = {GetDisabledBitset<Components>(registry_)...};
+    const auto isEnabled = [&](unsigned index)
+    {
+        return ea::none_of(ea::begin(disabledBitsets), ea::end(disabledBitsets),
+            [&](const EntityBitset* bitset) { return bitset && bitset->Test(index); });
+    };
+
+    registry_.view<Components...>().each(
+        [&](entt::entity entity, auto&... components)
+    {
+        if (isEnabled(GetEntityIndex(entity)))
+            callback(entity, components...);
+    });
+}
+
+template <class T> const EntityBitset* EntityManager::GetDisabledBitset(const entt::registry& registry)
+{
+    const auto disabledComponents = registry.ctx().find<EntityDisabledComponents<T>>();
+    return disabledComponents && !disabledComponents->bitset_.IsEmpty() ? &disabledComponents->bitset_ : nullptr;
+}
+
+inline unsigned EntityBitset::CountTrailingZeros(Word word)
+{
+    URHO3D_ASSERT(word != 0);
+#if defined(_MSC_VER)
+    unsigned long index{};
+    _BitScanForward64(&index, word);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctzll(word));
+#endif
+}
+
+template <class Callback> void EntityBitset::ForEach(const Callback& callback) const
+{
+    for (unsigned wordIndex = 0; wordIndex < words_.size(); ++wordIndex)
+    {
+        Word word = words_[wordIndex];
+        while (word != 0)
+        {
+            callback(wordIndex * BitsPerWord + CountTrailingZeros(word));
+            // Clear lowest set bit.
+            word &= word - 1;
+        }
+    }
+}
+
+template <class Callback>
+void EntityBitset::ForEachEntity(const entt::registry& registry, const Callback& callback) const
+{
+    const auto* entityStorage = registry.storage<entt::entity>();
+    if (!entityStorage)
+        return;
+
+    ForEach(
+        [&](unsigned index)
+    {
+        const auto version = entityStorage->current(static_cast<entt::entity>(index));
+        const auto entity = entt::entt_traits<entt::entity>::construct(index, version);
+        if (registry.valid(entity))
+            callback(entity);
+    });
+}
+
+template <class T>
+void TagEntityComponentFactory<T>::SerializeComponents(Archive& archive, entt::registry& registry, unsigned version)
+{
+    if (archive.IsInput() && version < EntityTagRangesVersion)
+    {
+        EntityManager::SerializeComponents<T>(archive, "components", registry, version);
+        return;
+    }
+
+    if (!archive.IsInput())
+    {
+        static thread_local EntityBitset savedBuffer;
+        auto& saved = savedBuffer;
+
+        // Inherited tags are restored from templates on load.
+        saved.Clear();
+        for (const entt::entity entity : registry.view<T>())
+        {
+            if (!EntityManager::IsComponentInherited<T>(registry, entity))
+                saved.Set(EntityManager::GetEntityIndex(entity));
+        }
+        saved.SerializeRanges(archive, "ranges");
+        return;
+    }
+
+    static thread_local EntityBitset loadedBuffer;
+    auto& loaded = loadedBuffer;
+    loaded.Clear();
+    loaded.SerializeRanges(archive, "ranges");
+
+    // Entity versions are restored from entities serialized before components.
+    const auto* entityStorage = std::as_const(registry).template storage<entt::entity>();
+    loaded.ForEach(
+        [&](unsigned index)
+    {
+        if (!entityStorage)
+            throw ArchiveException("Invalid entity #{} of tag '{}'", index, this->GetName());
+
+        const auto entityVersion = entityStorage->current(static_cast<entt::entity>(index));
+        const auto entity = entt::entt_traits<entt::entity>::construct(index, entityVersion);
+        if (!registry.valid(entity))
+            throw ArchiveException("Invalid entity #{} of tag '{}'", index, this->GetName());
+
+        registry.emplace_or_replace<T>(entity);
+    });
+}
+
+template <class T>
+void EntityDisabledComponents<T>::SetDisabled(entt::registry& registry, entt::entity entity, bool disabled)
+{
+    const unsigned index = EntityManager::GetEntityIndex(entity);
+    if (bitset_.Test(index) == disabled)
+        return;
+
+    if (disabled)
+    {
+        bitset_.Set(index);
+        onDisabled_.publish(registry, entity);
+    }
+    else
+    {
+        bitset_.Reset(index);
+        onEnabled_.publish(registry, entity);
+    }
+}
+
+template <class T> void DisabledEntityComponentFactory<T>::Initialize(entt::registry& registry)
+{
+    GetDisabledComponents(registry).bitset_.Clear();
+
+    // Disabled state doesn't outlive the component.
+    registry.on_destroy<T>().template connect<&DisabledEntityComponentFactory<T>::OnComponentDestroyed>(*this);
+}
+
+template <class T>
+EntityDisabledComponents<T>& DisabledEntityComponentFactory<T>::GetDisabledComponents(entt::registry& registry)
+{
+    return registry.ctx().emplace<EntityDisabledComponents<T>>();
+}
+
+template <class T>
+void DisabledEntityComponentFactory<T>::OnComponentDestroyed(entt::registry& registry, entt::entity entity)
+{
+    GetDisabledComponents(registry).SetDisabled(registry, entity, false);
+}
+
+template <class T>
+bool DisabledEntityComponentFactory<T>::HasComponent(entt::registry& registry, entt::entity entity)
+{
+    return GetDisabledComponents(registry).bitset_.Test(EntityManager::GetEntityIndex(entity));
+}
+
+template <class T>
+void DisabledEntityComponentFactory<T>::CreateComponent(entt::registry& registry, entt::entity entity)
+{
+    if (!registry.all_of<T>(entity))
+    {
+        URHO3D_LOGERROR("Cannot disable missing component '{}' in entity {}", this->GetName(), entity);
+        return;
+    }
+    GetDisabledComponents(registry).SetDisabled(registry, entity, true);
+}
+
+template <class T>
+void DisabledEntityComponentFactory<T>::DestroyComponent(entt::registry& registry, entt::entity entity)
+{
+    GetDisabledComponents(registry).SetDisabled(registry, entity, false);
+}
+
+template <class T>
+void DisabledEntityComponentFactory<T>::SerializeComponents(
+    Archive& archive, entt::registry& registry, unsigned version)
+{
+    auto& disabledComponents = GetDisabledComponents(registry);
+    if (!archive.IsInput())
+    {
+        disabledComponents.bitset_.SerializeRanges(archive, "ranges");
+        return;
+    }
+
+    // Components inherited from templates don't exist yet, so the state is applied in OnRegistryLoaded.
+    disabledComponents.pendingBitset_.Clear();
+    disabledComponents.pendingBitset_.SerializeRanges(archive, "ranges");
+}
+
+template <class T> void DisabledEntityComponentFactory<T>::OnRegistryLoaded(entt::registry& registry)
+{
+    auto& disabledComponents = GetDisabledComponents(registry);
+
+    // State of missing components is dropped.
+    disabledComponents.pendingBitset_.ForEachEntity(registry,
+        [&](entt::entity entity)
+    {
+        if (registry.all_of<T>(entity))
+            disabledComponents.SetDisabled(registry, entity, true);
+    });
+    disabledComponents.pendingBitset_.Clear();
+}
+
+template <class T>
+bool DisabledEntityComponentFactory<T>::ConnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query)
+{
+    auto& disabledComponents = GetDisabledComponents(registry);
+    if (query.IsTriggeredOnAdded())
+        entt::sink{disabledComponents.onDisabled_}.template connect<&EntityReactiveQuery::OnTriggered>(query);
+    entt::sink{disabledComponents.onEnabled_}.template connect<&EntityReactiveQuery::OnTriggerRemoved>(query);
+    return true;
+}
+
+template <class T>
+void DisabledEntityComponentFactory<T>::DisconnectReactiveQuery(entt::registry& registry, EntityReactiveQuery& query)
+{
+    auto& disabledComponents = GetDisabledComponents(registry);
+    entt::sink{disabledComponents.onDisabled_}.disconnect(&query);
+    entt::sink{disabledComponents.onEnabled_}.disconnect(&query);
+}
+
+template <class T>
+void DisabledEntityComponentFactory<T>::SerializeSnapshot(Archive& archive, entt::registry& registry)
+{
+    auto& disabledComponents = GetDisabledComponents(registry);
+    if (!archive.IsInput())
+    {
+        disabledComponents.bitset_.SerializeWords(archive);
+        return;
+    }
+
+    static thread_local EntityBitset loadedBuffer;
+    auto& loaded = loadedBuffer;
+    loaded.SerializeWords(archive);
+
+    // Only changed bits are applied, so that reactive queries see the difference.
+    // Resetting bits doesn't resize the bitset, so it is safe to do during iteration.
+    disabledComponents.bitset_.ForEachEntity(registry,
+        [&](entt::entity entity)
+    {
+        if (!loaded.Test(EntityManager::GetEntityIndex(entity)))
+            disabledComponents.SetDisabled(registry, entity, false);
+    });
+    loaded.ForEachEntity(
+        registry, [&](entt::entity entity) { disabledComponents.SetDisabled(registry, entity, true); });
+}
+
+template <class T>
+void DisabledEntityComponentFactory<T>::MergeComponents(
+    entt::registry& registry, entt::registry& sourceRegistry, const EntityRemap& remap)
+{
+    const auto sourceComponents = sourceRegistry.ctx().find<EntityDisabledComponents<T>>();
+    if (!sourceComponents)
+        return;
+
+    auto& disabledComponents = GetDisabledComponents(registry);
+    sourceComponents->bitset_.ForEachEntity(sourceRegistry,
+        [&](entt::entity sourceEntity)
+    {
+        const entt::entity entity = remap.Remap(sourceEntity);
+        if (entity != entt::null && registry.all_of<T>(entity))
+            disabledComponents.SetDisabled(registry, entity, true);
+    });
+}
+
+template <class T>
+void DisabledEntityComponentFactory<T>::CloneComponent(
+    entt::registry& registry, entt::entity entity, ea::span<const entt::entity> clones)
+{
+    auto& disabledComponents = GetDisabledComponents(registry);
+    if (!disabledComponents.bitset_.Test(EntityManager::GetEntityIndex(entity)))
+        return;
+
+    for (const entt::entity clone : clones)
+    {
+        if (registry.all_of<T>(clone))
+            disabledComponents.SetDisabled(registry, clone, true);
+    }
+}
+
+} // namespace Urho3D